@@ -1,100 +1,549 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include <sys/stat.h>
 
 #include "src/image.h"
 #include "src/distance_functions.h"
 #include "src/scene.h"
+#include "src/scene_builder.h"
+#include "src/scene_text.h"
+#include "src/compiled_scene.h"
+#include "src/scene_diff.h"
+#include "src/tile_cache.h"
+#include "src/instance.h"
+#include "src/primitive_set.h"
+#include "src/repetition.h"
+#include "src/transform.h"
+#include "src/static_scene.h"
+#include "src/shared_framebuffer.h"
+#include "src/video_stream.h"
+
+
+/// How main builds the scenes of kScenes
+struct SceneOptions {
+    SceneRepresentation representation = SceneRepresentation::Arena;
+    bool optimize = false;
+    std::string scene_file; // for SceneFromFile
+};
 
+/// Culling margin for SceneBuilder::optimize: eps and a few pixels of the 1024 px frames,
+/// so nothing culled could have shown up in the anti-aliased modes either
+const double kCullMargin = 1e-2;
+
+/// Builds the scene, optimized for its viewport if the options ask for it
+Scene BuildScene(SceneBuilder& builder, double x_min, double x_max, double y_min, double y_max, RGBColor background,
+                 const SceneOptions& options) {
+    if (options.optimize) {
+        OptimizeStats stats = builder.optimize(x_min, x_max, y_min, y_max, kCullMargin);
+        std::cout << " nodes " << stats.nodes_before << " -> " << stats.nodes_after << "..." << std::flush;
+    }
+    return builder.build(x_min, x_max, y_min, y_max, background, options.representation);
+}
 
 /// YDS logo lookalike
 /// Shows off different primitives implemented
-Scene Scene1() {
-    return Scene({
-        std::make_shared<AxisAlignedEquilateralTriangle>(-0.66, 0.0, 0.25, Color({255, 197, 70})),
-        std::make_shared<Circle>(0.0, 0.0, 0.25, Color({225, 11, 16})),
-        std::make_shared<AxisAlignedRectangle>(0.66, 0.0, 0.25, 0.25, Color({0, 0, 0})),
-    }, -1, 1, -1, 1, {79, 134, 160});
+Scene Scene1(const SceneOptions& options) {
+    SceneBuilder builder;
+    builder.addObject(builder.addAxisAlignedEquilateralTriangle(-0.66, 0.0, 0.25, Color({255, 197, 70})));
+    builder.addObject(builder.addCircle(0.0, 0.0, 0.25, Color({225, 11, 16})));
+    builder.addObject(builder.addAxisAlignedRectangle(0.66, 0.0, 0.25, 0.25, Color({0, 0, 0})));
+    return BuildScene(builder, -1, 1, -1, 1, {79, 134, 160}, options);
 }
 
-Scene Scene2() {
-    return Scene({
-        std::make_shared<Overlay>(
-            std::make_shared<Circle>(-0.15, -0.3, 0.25, RGBColor{255, 0, 0}),
-            std::make_shared<Circle>(0.15, -0.3, 0.25, RGBColor{255, 160, 0})
-        ),
-        std::make_shared<Overlay>(
-            std::make_shared<AxisAlignedRectangle>(0., 0.3, 0.35, 0.25,
-                                                   Color({255, 84, 126},
-                                                         {109, 252, 255},
-                                                         {0,0,0}, 4, 0.03)),
-            std::make_shared<Intersection>(
-                std::make_shared<Intersection>(
-                    std::make_shared<Intersection>(
-                        std::make_shared<Intersection>(
-                            std::make_shared<AxisAlignedRectangle>(0., 0., 0.55, 0.75,
-                                                                   Color({0, 204, 255},
-                                                                         {0, 120, 255},
-                                                                         {255,255,255}, 2, 0.1)),
-                            std::make_shared<Segment>(-0.75, -0.7, 0.75, -0.45, RGBColor{0, 120, 255}),
-                        true),
-                        std::make_shared<Segment>(-0.75, -0.1, 0.75, -0.25, RGBColor{255, 0, 255}),
-                    true),
-                    std::make_shared<Segment>(-0.75, 0.1, 0.75, 0.3, RGBColor{120, 255, 0}),
-                true),
-                std::make_shared<Segment>(-0.75, 0.7, 0.75, 0.45, RGBColor{120, 120, 190}),
-            true)
-        )
-    }, -1, 1, -1, 1, {160, 134, 79});
-}
-
-Scene Scene3() {
+/// Scene1 as a compile-time scene graph: its type is the whole logo,
+/// so RenderToImage becomes one kernel with every shape inlined
+auto StaticScene1() {
+    return StaticScene(-1, 1, -1, 1, {79, 134, 160},
+        StaticAxisAlignedEquilateralTriangle(-0.66, 0.0, 0.25, FlatColor{{255, 197, 70}}),
+        StaticCircle(0.0, 0.0, 0.25, FlatColor{{225, 11, 16}}),
+        StaticAxisAlignedRectangle(0.66, 0.0, 0.25, 0.25, FlatColor{{0, 0, 0}})
+    );
+}
+
+Scene Scene2(const SceneOptions& options) {
+    SceneBuilder builder;
+    builder.addObject(builder.addOverlay(
+        builder.addCircle(-0.15, -0.3, 0.25, RGBColor{255, 0, 0}),
+        builder.addCircle(0.15, -0.3, 0.25, RGBColor{255, 160, 0})
+    ));
+
+    NodeId stripes = builder.addAxisAlignedRectangle(0., 0., 0.55, 0.75,
+                                                     Color({0, 204, 255},
+                                                           {0, 120, 255},
+                                                           {255,255,255}, 2, 0.1));
+    stripes = builder.addIntersection(stripes, builder.addSegment(-0.75, -0.7, 0.75, -0.45, RGBColor{0, 120, 255}), true);
+    stripes = builder.addIntersection(stripes, builder.addSegment(-0.75, -0.1, 0.75, -0.25, RGBColor{255, 0, 255}), true);
+    stripes = builder.addIntersection(stripes, builder.addSegment(-0.75, 0.1, 0.75, 0.3, RGBColor{120, 255, 0}), true);
+    stripes = builder.addIntersection(stripes, builder.addSegment(-0.75, 0.7, 0.75, 0.45, RGBColor{120, 120, 190}), true);
+    builder.addObject(builder.addOverlay(
+        builder.addAxisAlignedRectangle(0., 0.3, 0.35, 0.25,
+                                        Color({255, 84, 126},
+                                              {109, 252, 255},
+                                              {0,0,0}, 4, 0.03)),
+        stripes
+    ));
+    return BuildScene(builder, -1, 1, -1, 1, {160, 134, 79}, options);
+}
+
+Scene Scene3(const SceneOptions& options) {
+    SceneBuilder builder;
+    builder.addObject(builder.addOverlay(
+        builder.addSDFImage("../A.png", -0.7, -0.7, 0.3, Color({0, 0, 0})),
+        builder.addSDFImage("../Y.png", -0.525, -0.6, 0.3, Color({255, 255, 255})),
+    0.7));
+    builder.addObject(builder.addSDFImage("../sdf.png", 0, 0.1, 1., Color({255, 152, 70}, {255, 222, 0}, {255,255,255}, 3, 0.4)));
+    builder.addObject(builder.addAxisAlignedEquilateralTriangle(0, 0, .75, Color({255, 90, 90}, 0.1, {0, 0, 0})));
+    builder.addObject(builder.addIntersection(
+        builder.addCircle(0.725, -0.7, 0.125, Color({255, 0, 0})),
+        builder.addIntersection(
+            builder.addCircle(0.475, -0.7, 0.125, Color({0, 255, 0})),
+            builder.addCircle(0.6, -0.5, 0.125, Color({0, 0, 255})),
+        true),
+    true));
+    return BuildScene(builder, -1, 1, -1, 1, {192, 192, 192}, options);
+}
+
+/// The scene of a text scene file, see src/scene_text.h, or of a compiled one, see src/compiled_scene.h.
+/// Compiled scenes come out as they were saved, whatever the options
+Scene SceneFromFile(const SceneOptions& options) {
+    if (IsCompiledScene(options.scene_file)) {
+        return LoadCompiledScene(options.scene_file);
+    }
+    SceneBuilder builder;
+    SceneTextHeader header = LoadSceneTextOrExit(options.scene_file, builder);
+    return BuildScene(builder, header.x_min, header.x_max, header.y_min, header.y_max, header.background, options);
+}
+
+/// Frame of a short looping animation, t in [0, 1)
+/// Two circles orbit each other and melt together when they meet
+Scene AnimatedScene(double t) {
+    double angle = 2 * M_PI * t;
     return Scene({
-        std::make_shared<Overlay>(
-            std::make_shared<SDFImage>("../A.png", -0.7, -0.7, 0.3, Color({0, 0, 0})),
-            std::make_shared<SDFImage>("../Y.png", -0.525, -0.6, 0.3, Color({255, 255, 255})),
-        0.7),
-        std::make_shared<SDFImage>("../sdf.png", 0, 0.1, 1., Color({255, 152, 70}, {255, 222, 0}, {255,255,255}, 3, 0.4)),
-        std::make_shared<AxisAlignedEquilateralTriangle>(0, 0, .75, Color({255, 90, 90}, 0.1, {0, 0, 0})),
         std::make_shared<Intersection>(
-            std::make_shared<Circle>(0.725, -0.7, 0.125, Color({255, 0, 0})),
-            std::make_shared<Intersection>(
-                    std::make_shared<Circle>(0.475, -0.7, 0.125, Color({0, 255, 0})),
-                    std::make_shared<Circle>(0.6, -0.5, 0.125, Color({0, 0, 255})),
-            true),
-        true)
-    }, -1, 1, -1, 1, {192, 192, 192});
+            MakeCircle(0.4 * std::cos(angle), 0.4 * std::sin(angle), 0.2,
+                       Color({255, 84, 126}, {109, 252, 255}, 4)),
+            MakeCircle(-0.4 * std::cos(angle), 0.2 * std::sin(2 * angle), 0.2,
+                       Color({0, 204, 255}, 0.03, {255, 255, 255})),
+        true, 0.3),
+        MakeAxisAlignedRectangle(0., 0., 0.9 - 0.1 * std::cos(angle), 0.9 - 0.1 * std::sin(angle),
+                                 Color({79, 134, 160}, {160, 134, 79}, 2))
+    }, -1, 1, -1, 1, {30, 30, 30});
+}
+
+struct SceneEntry {
+    const char* name;
+    Scene (*build)(const SceneOptions&);
+    const char* output_path;
+};
+
+const SceneEntry kScenes[] = {
+    {"Scene1", Scene1, "../scene1.png"},
+    {"Scene2", Scene2, "../scene2.png"},
+    {"Scene3", Scene3, "../scene3.png"},
+};
+
+enum class RenderMode {
+    Hard,     // one sample, distance < eps decides
+    Analytic, // one sample, coverage from the signed distance
+    Adaptive, // one sample, 4x4 supersampling near edges
+    Deferred, // hard edges, coverage and shading in separate multithreaded passes
+};
+
+template<typename SceneType, typename Image>
+void Render(SceneType& scene, Image& image, RenderMode mode) {
+    switch (mode) {
+        case RenderMode::Hard:
+            scene.RenderToImage(image, 2e-3);
+            break;
+        case RenderMode::Analytic:
+            scene.RenderToImageAntialiased(image, 2e-3);
+            break;
+        case RenderMode::Adaptive:
+            scene.RenderToImageAdaptive(image, 2e-3);
+            break;
+        case RenderMode::Deferred:
+            scene.RenderToImageDeferred(image, 2e-3);
+            break;
+    }
+}
+
+/// How far from a sample the renderers look: eps and the pixels around an edge the anti-aliased
+/// modes take in, with room to spare
+double SampleReach(const Bounds& view, size_t height, size_t width) {
+    return 2e-3 + 4 * std::max((view.x_max - view.x_min) / width, (view.y_max - view.y_min) / height);
+}
+
+const char* RenderModeName(RenderMode mode) {
+    switch (mode) {
+        case RenderMode::Hard:
+            return "hard";
+        case RenderMode::Analytic:
+            return "analytic";
+        case RenderMode::Adaptive:
+            return "adaptive";
+        case RenderMode::Deferred:
+            return "deferred";
+    }
+    return "";
 }
 
+/// Renders one tile of an image, pixels come out as in a render of the whole image
+void RenderTile(Scene& scene, AlignedImage<uint8_t, 3>& image, const PixelRect& tile, RenderMode mode) {
+    switch (mode) {
+        case RenderMode::Hard:
+        case RenderMode::Deferred: // same image as hard, a tile is too small for the batches to pay off
+            scene.RenderToImage(image, tile, 2e-3);
+            break;
+        case RenderMode::Analytic:
+            scene.RenderToImageAntialiased(image, tile, 2e-3);
+            break;
+        case RenderMode::Adaptive:
+            scene.RenderToImageAdaptive(image, tile, 2e-3);
+            break;
+    }
+}
 
-int main() {
-    Image<uint8_t> rgb_image(1024, 1024, 3);
+/// Render, through the tile cache when there is one. Only scenes of flat nodes go through it
+template<typename SceneType>
+void Render(SceneType& scene, AlignedImage<uint8_t, 3>& image, RenderMode mode, const TileCache* cache) {
+    if constexpr (std::is_same_v<SceneType, Scene>) {
+        if (cache) {
+            double margin = SampleReach(scene.view(), image.height_, image.width_);
+            TileCacheStats stats = cache->render(scene, image, RenderModeName(mode), margin, [&](const PixelRect& tile) {
+                RenderTile(scene, image, tile, mode);
+            });
+            std::cout << " tiles reused " << stats.reused << "/" << stats.tiles << "..." << std::flush;
+            return;
+        }
+    }
+    Render(scene, image, mode);
+}
 
-    std::cout << "Rendering Scene1..." << std::flush;
-    auto scene = Scene1();
+template<typename Function>
+long long MeasureMicroseconds(Function&& function) {
     std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-    scene.RenderToImage(rgb_image, 2e-3);
+    function();
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-    Save8bitRgbImage("../scene1.png", rgb_image);
-    std::cout << " Done" << std::endl;
-    std::cout << "It took: " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " [µs]" << std::endl;
-
-    std::cout << "Rendering Scene2..." << std::flush;
-    scene = Scene2();
-    begin = std::chrono::steady_clock::now();
-    scene.RenderToImage(rgb_image, 2e-3);
-    end = std::chrono::steady_clock::now();
-    Save8bitRgbImage("../scene2.png", rgb_image);
-    std::cout << " Done" << std::endl;
-    std::cout << "It took: " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " [µs]" << std::endl;
-
-    std::cout << "Rendering Scene3..." << std::flush;
-    scene = Scene3();
-    begin = std::chrono::steady_clock::now();
-    scene.RenderToImage(rgb_image, 2e-3);
-    end = std::chrono::steady_clock::now();
-    Save8bitRgbImage("../scene3.png", rgb_image);
-    std::cout << " Done" << std::endl;
-    std::cout << "It took: " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " [µs]" << std::endl;
-
-}
\ No newline at end of file
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+}
+
+void PrintUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--shm NAME] [--stream y4m|y4m444|raw [--frames N] [--fps N]] [--mode MODE] [--float] [--huge-pages] [--nodes arena|flat|static] [--optimize] [--scene FILE [--compile OUT | --watch]] [--tile-cache DIR]" << std::endl;
+    std::cerr << "  --shm NAME     publish frames to the shared memory framebuffer ring NAME instead of writing PNGs" << std::endl;
+    std::cerr << "  --stream FMT   render the animation and stream it to stdout as 4:2:0 or 4:4:4 Y4M or raw rgb24" << std::endl;
+    std::cerr << "  --frames N     number of animation frames, 120 by default" << std::endl;
+    std::cerr << "  --fps N        frame rate written to the Y4M header, 30 by default" << std::endl;
+    std::cerr << "  --mode MODE    hard (default): one sample, hard edges" << std::endl;
+    std::cerr << "                 analytic: one sample, anti-aliased with coverage from the distance" << std::endl;
+    std::cerr << "                 adaptive: one sample, 4x4 supersampling only for pixels near edges" << std::endl;
+    std::cerr << "                 deferred: same image as hard, coverage pass then batched shading pass on all cores" << std::endl;
+    std::cerr << "  --float        render in linear float and write 16 bit PNGs and float32 PFMs" << std::endl;
+    std::cerr << "  --huge-pages   back image buffers with huge pages where the system allows it" << std::endl;
+    std::cerr << "  --nodes KIND   arena (default): scene nodes are SDF objects in one allocation" << std::endl;
+    std::cerr << "                 flat: scene nodes are plain records evaluated with a switch" << std::endl;
+    std::cerr << "                 static: Scene1 is a compile-time scene graph, the others use arena" << std::endl;
+    std::cerr << "  --optimize     flatten, fold and cull the scene graphs for their viewport before rendering" << std::endl;
+    std::cerr << "  --scene FILE   render the text or compiled scene FILE to FILE with a .png extension instead of the built-in scenes" << std::endl;
+    std::cerr << "  --compile OUT  write the scene of --scene to the compiled scene file OUT instead of rendering it" << std::endl;
+    std::cerr << "  --tile-cache DIR  keep rendered 64 px tiles in DIR and reuse every tile whose contents didn't change, implies --nodes flat" << std::endl;
+    std::cerr << "  --watch        keep rendering the text scene of --scene whenever it changes, redrawing only the tiles that changed" << std::endl;
+}
+
+int StreamAnimation(StreamFormat format, int frames, int fps, size_t height, size_t width, BufferPool& pool,
+                    RenderMode mode) {
+    // a reader that goes away fails the writes instead of killing the process with SIGPIPE
+    std::signal(SIGPIPE, SIG_IGN);
+    VideoStreamWriter writer(stdout, format, height, width, fps);
+    for (int i = 0; i < frames && writer.good(); ++i) {
+        AlignedImage<uint8_t, 3> frame(height, width, pool);
+        auto scene = AnimatedScene(double(i) / frames);
+        Render(scene, frame, mode);
+        writer.WriteFrame(frame);
+        std::cerr << "\rStreamed frame " << i + 1 << "/" << frames << std::flush;
+    }
+    std::cerr << std::endl;
+    std::cerr << "Frame buffers mapped: " << pool.stats().allocations << ", reused: " << pool.stats().reuses << std::endl;
+    if (!writer.good()) {
+        std::cerr << "Output stream closed early" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/// A text scene file as --watch keeps it: the flat nodes for SceneDiff and a scene rendering them
+struct WatchedScene {
+    SceneTextHeader header;
+    std::shared_ptr<const FlatScene> flat;
+    std::vector<NodeId> objects;
+    Scene scene;
+};
+
+/// Throws SceneTextError like LoadSceneText
+WatchedScene LoadWatchedScene(const SceneOptions& options) {
+    SceneBuilder builder;
+    SceneTextHeader header = LoadSceneText(options.scene_file, builder);
+    if (options.optimize) {
+        builder.optimize(header.x_min, header.x_max, header.y_min, header.y_max, kCullMargin);
+    }
+    std::vector<NodeId> roots;
+    std::shared_ptr<const FlatScene> flat = builder.buildFlat(&roots);
+    std::vector<std::shared_ptr<SDF>> objects;
+    for (NodeId root : roots) {
+        objects.push_back(std::make_shared<FlatObject>(flat, root));
+    }
+    return {header, flat, roots, Scene(objects, header.x_min, header.x_max, header.y_min, header.y_max, header.background)};
+}
+
+/// Last change of the file in nanoseconds, -1 while it can't be read
+long long ModificationTime(const std::string& path) {
+    struct stat info{};
+    if (stat(path.c_str(), &info) != 0) {
+        return -1;
+    }
+    return (long long)(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+/// Renders the scene file and keeps watching it. After a change only the tiles SceneDiff finds changed
+/// are rendered and PNG encoded again, the rest of the image stays from before. A version of the file
+/// that fails to parse is reported and skipped. Runs until killed
+int WatchScene(const SceneOptions& options, const std::string& output_path, size_t height, size_t width,
+               BufferPool& pool, RenderMode mode, SharedFramebuffer* framebuffer) {
+    const size_t kTileSize = 64;
+    const auto kPollInterval = std::chrono::milliseconds(50);
+    AlignedImage<uint8_t, 3> image(height, width, pool);
+    BandedPngWriter png(height, width, kTileSize);
+    std::optional<WatchedScene> current;
+    long long seen = -1;
+    while (true) {
+        long long modified = ModificationTime(options.scene_file);
+        if (modified < 0 || modified == seen) {
+            std::this_thread::sleep_for(kPollInterval);
+            continue;
+        }
+        seen = modified;
+        std::optional<WatchedScene> loaded;
+        try {
+            loaded = LoadWatchedScene(options);
+        } catch (const SceneTextError& error) {
+            // a typo or a half saved file, the last good image stays until the next change
+            std::cerr << error.what() << std::endl;
+            continue;
+        }
+        WatchedScene& next = *loaded;
+        const SceneTextHeader& header = next.header;
+        double margin = SampleReach(next.scene.view(), height, width);
+        std::vector<Bounds> changed = {Bounds::Everything()};
+        if (current && current->header.x_min == header.x_min && current->header.x_max == header.x_max &&
+            current->header.y_min == header.y_min && current->header.y_max == header.y_max &&
+            current->header.background.r == header.background.r && current->header.background.g == header.background.g &&
+            current->header.background.b == header.background.b) {
+            changed = SceneDiff(*current->flat, current->objects, *next.flat, next.objects).changed();
+        }
+        current = std::move(next);
+        std::vector<PixelRect> tiles = TilesCovering(changed, margin, current->scene.view(), height, width, kTileSize);
+        long long render_time = MeasureMicroseconds([&] {
+            ParallelFor(tiles.size(), [&](size_t begin, size_t end) {
+                for (size_t t = begin; t < end; ++t) {
+                    RenderTile(current->scene, image, tiles[t], mode);
+                }
+            });
+        });
+        long long encode_time = MeasureMicroseconds([&] {
+            if (tiles.empty()) {
+                return;
+            }
+            if (framebuffer) {
+                auto frame = framebuffer->BeginFrame();
+                for (size_t i = 0; i < height; ++i) {
+                    std::memcpy(frame.row(i), image.row(i), width * 3);
+                }
+                framebuffer->Publish();
+                return;
+            }
+            // tiles are in row major order and every row of tiles is one band of the PNG
+            for (size_t t = 0; t < tiles.size(); ++t) {
+                if (t == 0 || tiles[t].row_begin != tiles[t - 1].row_begin) {
+                    png.update(image, tiles[t].row_begin, tiles[t].row_end);
+                }
+            }
+            png.save(output_path);
+        });
+        std::cout << "Updated " << tiles.size() << " of " << ((height + kTileSize - 1) / kTileSize) * ((width + kTileSize - 1) / kTileSize)
+                  << " tiles, render " << render_time << " [µs], output " << encode_time << " [µs]" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string shm_name;
+    std::string stream_format;
+    int frames = 120, fps = 30;
+    bool huge_pages = false;
+    bool float_output = false;
+    RenderMode mode = RenderMode::Hard;
+    SceneOptions scene_options;
+    bool static_logo = false;
+    std::string compile_path;
+    bool watch = false;
+    std::string tile_cache_directory;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--shm" && i + 1 < argc) {
+            shm_name = argv[++i];
+        } else if (arg == "--stream" && i + 1 < argc) {
+            stream_format = argv[++i];
+        } else if (arg == "--mode" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "hard") {
+                mode = RenderMode::Hard;
+            } else if (name == "analytic") {
+                mode = RenderMode::Analytic;
+            } else if (name == "adaptive") {
+                mode = RenderMode::Adaptive;
+            } else if (name == "deferred") {
+                mode = RenderMode::Deferred;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--nodes" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "arena") {
+                scene_options.representation = SceneRepresentation::Arena;
+            } else if (name == "flat") {
+                scene_options.representation = SceneRepresentation::Flat;
+            } else if (name == "static") {
+                static_logo = true;
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--scene" && i + 1 < argc) {
+            scene_options.scene_file = argv[++i];
+        } else if (arg == "--compile" && i + 1 < argc) {
+            compile_path = argv[++i];
+        } else if (arg == "--tile-cache" && i + 1 < argc) {
+            tile_cache_directory = argv[++i];
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--optimize") {
+            scene_options.optimize = true;
+        } else if (arg == "--float") {
+            float_output = true;
+        } else if (arg == "--huge-pages") {
+            huge_pages = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = std::atoi(argv[++i]);
+            if (frames <= 0) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--fps" && i + 1 < argc) {
+            fps = std::atoi(argv[++i]);
+            if (fps <= 0) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!compile_path.empty()) {
+        if (scene_options.scene_file.empty()) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        SceneBuilder builder;
+        SceneTextHeader header = LoadSceneTextOrExit(scene_options.scene_file, builder);
+        if (scene_options.optimize) {
+            builder.optimize(header.x_min, header.x_max, header.y_min, header.y_max, kCullMargin);
+        }
+        SaveCompiledScene(compile_path, builder, header.x_min, header.x_max, header.y_min, header.y_max, header.background);
+        return 0;
+    }
+
+    const size_t height = 1024, width = 1024;
+    BufferPool pool(huge_pages);
+    if (!stream_format.empty()) {
+        if (stream_format == "y4m") {
+            return StreamAnimation(StreamFormat::Y4M420, frames, fps, height, width, pool, mode);
+        } else if (stream_format == "y4m444") {
+            return StreamAnimation(StreamFormat::Y4M444, frames, fps, height, width, pool, mode);
+        } else if (stream_format == "raw") {
+            return StreamAnimation(StreamFormat::RawRGB, frames, fps, height, width, pool, mode);
+        }
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<TileCache> tile_cache;
+    if (!tile_cache_directory.empty()) {
+        tile_cache = std::make_unique<TileCache>(tile_cache_directory);
+        scene_options.representation = SceneRepresentation::Flat;
+    }
+    std::unique_ptr<SharedFramebuffer> framebuffer;
+    if (!shm_name.empty()) {
+        framebuffer = std::make_unique<SharedFramebuffer>(shm_name, height, width);
+    }
+    std::vector<SceneEntry> scenes(std::begin(kScenes), std::end(kScenes));
+    std::string scene_output;
+    if (!scene_options.scene_file.empty()) {
+        const std::string& file = scene_options.scene_file;
+        size_t slash = file.find_last_of('/'), dot = file.find_last_of('.');
+        bool has_extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        scene_output = file.substr(0, has_extension ? dot : file.size()) + ".png";
+        scenes = {{"scene file", SceneFromFile, scene_output.c_str()}};
+    }
+    if (watch) {
+        if (scene_options.scene_file.empty() || float_output || IsCompiledScene(scene_options.scene_file)) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        return WatchScene(scene_options, scene_output, height, width, pool, mode, framebuffer.get());
+    }
+    for (const auto& entry : scenes) {
+        std::cout << "Rendering " << entry.name << "..." << std::flush;
+        auto render_scene = [&](auto& scene) {
+            long long elapsed = 0;
+            if (float_output) {
+                AlignedImage<float, 3> float_image(height, width, pool);
+                elapsed = MeasureMicroseconds([&] { Render(scene, float_image, mode); });
+                std::string path = entry.output_path;
+                path.resize(path.size() - 4); // drop .png
+                Save16bitRgbImage(path + "_16bit.png", float_image);
+                SaveFloatRgbImage(path + ".pfm", float_image);
+            } else if (framebuffer) {
+                auto frame = framebuffer->BeginFrame();
+                elapsed = MeasureMicroseconds([&] { Render(scene, frame, mode, tile_cache.get()); });
+                framebuffer->Publish();
+            } else {
+                AlignedImage<uint8_t, 3> rgb_image(height, width, pool);
+                elapsed = MeasureMicroseconds([&] { Render(scene, rgb_image, mode, tile_cache.get()); });
+                Save8bitRgbImage(entry.output_path, rgb_image);
+            }
+            return elapsed;
+        };
+        long long elapsed = 0;
+        if (static_logo && entry.build == Scene1) {
+            auto scene = StaticScene1();
+            elapsed = render_scene(scene);
+        } else {
+            auto scene = entry.build(scene_options);
+            elapsed = render_scene(scene);
+        }
+        std::cout << " Done" << std::endl;
+        std::cout << "It took: " << elapsed << " [µs]" << std::endl;
+    }
+}
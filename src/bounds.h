@@ -0,0 +1,57 @@
+#ifndef SDF_BOUNDS_H
+#define SDF_BOUNDS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/// Axis aligned box around a shape. Outside of it a node's distance is at least the distance to the box,
+/// so a node whose box padded by m misses a region has distance >= m everywhere in that region.
+/// A box with min > max is empty; padding may turn it into a real one
+struct Bounds {
+    double x_min, x_max, y_min, y_max;
+
+    static Bounds Empty() {
+        double inf = std::numeric_limits<double>::infinity();
+        return {inf, -inf, inf, -inf};
+    }
+
+    static Bounds Everything() {
+        double inf = std::numeric_limits<double>::infinity();
+        return {-inf, inf, -inf, inf};
+    }
+
+    bool empty() const {
+        return x_min > x_max || y_min > y_max;
+    }
+
+    Bounds united(const Bounds& other) const {
+        return {std::min(x_min, other.x_min), std::max(x_max, other.x_max),
+                std::min(y_min, other.y_min), std::max(y_max, other.y_max)};
+    }
+
+    Bounds padded(double margin) const {
+        return {x_min - margin, x_max + margin, y_min - margin, y_max + margin};
+    }
+
+    /// Distance from (x, y) to the box, 0 inside
+    double distance(double x, double y) const {
+        double dx = std::max({x_min - x, x - x_max, 0.0});
+        double dy = std::max({y_min - y, y - y_max, 0.0});
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    /// Gap between the closest points of two boxes, 0 if they overlap
+    double distance(const Bounds& other) const {
+        double dx = std::max({x_min - other.x_max, other.x_min - x_max, 0.0});
+        double dy = std::max({y_min - other.y_max, other.y_min - y_max, 0.0});
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    bool intersects(const Bounds& other) const {
+        return !empty() && !other.empty() &&
+               x_min <= other.x_max && other.x_min <= x_max && y_min <= other.y_max && other.y_min <= y_max;
+    }
+};
+
+#endif //SDF_BOUNDS_H
@@ -0,0 +1 @@
+#include "buffer_pool.h"
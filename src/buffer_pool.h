@@ -0,0 +1,127 @@
+#ifndef SDF_BUFFER_POOL_H
+#define SDF_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <sys/mman.h>
+
+/// Recycles large page-aligned buffers by size class, so rendering many frames or scenes
+/// does not map, fault in and zero fresh memory every time.
+/// Buffers come from anonymous mmap and are faulted in right away, optionally backed by huge pages.
+/// Recycled buffers keep their old contents.
+class BufferPool {
+public:
+    struct Stats {
+        size_t allocations = 0;    // buffers mapped from the system
+        size_t reuses = 0;         // requests served from the free lists
+        size_t bytes_mapped = 0;   // currently mapped, in use or free
+    };
+private:
+    static constexpr size_t kMinClass = size_t(1) << 16;   // smaller requests share the 64 KiB class
+    static constexpr size_t kHugePage = size_t(1) << 21;
+
+    bool huge_pages_;
+    std::mutex mutex_;
+    std::map<size_t, std::vector<void*>> free_; // size class -> free buffers
+    Stats stats_;
+
+    size_t sizeClass(size_t bytes) const {
+        size_t size = kMinClass;
+        while (size < bytes) {
+            size <<= 1;
+        }
+        if (huge_pages_ && size > kHugePage / 2) {
+            size = (size + kHugePage - 1) / kHugePage * kHugePage;
+        }
+        return size;
+    }
+
+    void* map(size_t size) {
+        void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (huge_pages_ && size % kHugePage == 0) {
+            // explicit huge pages only exist if the administrator reserved some, fall through otherwise
+            ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (ptr == MAP_FAILED) {
+            ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) {
+                std::cerr << "Failed to allocate " << size << " bytes for an image buffer" << std::endl;
+                exit(1);
+            }
+#ifdef MADV_HUGEPAGE
+            if (huge_pages_) {
+                madvise(ptr, size, MADV_HUGEPAGE); // transparent huge pages, a hint only
+            }
+#endif
+            // touch every page now instead of faulting during the render
+            volatile uint8_t* bytes = static_cast<uint8_t*>(ptr);
+            for (size_t offset = 0; offset < size; offset += 4096) {
+                bytes[offset] = 0;
+            }
+        }
+        return ptr;
+    }
+public:
+    explicit BufferPool(bool huge_pages=false): huge_pages_(huge_pages) {}
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /// Buffers still handed out when the pool dies are not unmapped,
+    /// images must not outlive their pool
+    ~BufferPool() {
+        Trim();
+    }
+
+    /// Page aligned buffer of at least `bytes` bytes with unspecified contents
+    void* Acquire(size_t bytes) {
+        size_t size = sizeClass(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& list = free_[size];
+            if (!list.empty()) {
+                void* ptr = list.back();
+                list.pop_back();
+                ++stats_.reuses;
+                return ptr;
+            }
+            ++stats_.allocations;
+            stats_.bytes_mapped += size;
+        }
+        return map(size);
+    }
+
+    /// Returns a buffer from Acquire(bytes), `bytes` must be the requested size
+    void Release(void* ptr, size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_[sizeClass(bytes)].push_back(ptr);
+    }
+
+    /// Unmaps all free buffers
+    void Trim() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [size, list] : free_) {
+            for (void* ptr : list) {
+                munmap(ptr, size);
+                stats_.bytes_mapped -= size;
+            }
+            list.clear();
+        }
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+};
+
+#endif //SDF_BUFFER_POOL_H
@@ -0,0 +1,465 @@
+#ifndef SDF_COLOR_H
+#define SDF_COLOR_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct RGBColor {
+    uint8_t r, g, b;
+};
+
+/// Linear light color in [0, 1]. Blending in this space does not lose precision,
+/// 8 bit values only appear when an image is written out
+struct LinearColor {
+    float r, g, b;
+};
+
+// Colors are stored with gamma 2, the same model MixColors blends with
+constexpr std::array<float, 256> MakeLinearTable() {
+    std::array<float, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        table[c] = float(c) / 255.f * (float(c) / 255.f);
+    }
+    return table;
+}
+
+constexpr std::array<float, 256> kLinearTable = MakeLinearTable();
+
+float ToLinear(uint8_t value) {
+    return kLinearTable[value];
+}
+
+LinearColor ToLinear(RGBColor color) {
+    return {ToLinear(color.r), ToLinear(color.g), ToLinear(color.b)};
+}
+
+LinearColor MixLinear(LinearColor first, LinearColor second, double alpha) {
+    float a = float(alpha);
+    return {
+            first.r * a + second.r * (1 - a),
+            first.g * a + second.g * (1 - a),
+            first.b * a + second.b * (1 - a)
+    };
+}
+
+// Blending tables. MixColors works on squared 8 bit values (gamma 2), so the forward table
+// holds c * c and the inverse one maps every possible blended value back to floor(sqrt(value)).
+constexpr int kMaxSquare = 255 * 255;
+
+constexpr std::array<float, 256> MakeSquareTable() {
+    std::array<float, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        table[c] = float(c * c);
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, kMaxSquare + 1> MakeSquareRootTable() {
+    std::array<uint8_t, kMaxSquare + 1> table{};
+    for (int c = 0; c < 256; ++c) {
+        for (int value = c * c; value < (c + 1) * (c + 1) && value <= kMaxSquare; ++value) {
+            table[value] = uint8_t(c);
+        }
+    }
+    return table;
+}
+
+constexpr std::array<float, 256> kSquareTable = MakeSquareTable();
+constexpr std::array<uint8_t, kMaxSquare + 1> kSquareRootTable = MakeSquareRootTable();
+
+// floor(sqrt(v)) == floor(sqrt(floor(v))) since perfect squares are integers,
+// so the lookup gives exactly what truncating the square root would
+uint8_t MixChannel(uint8_t first, uint8_t second, double alpha) {
+    double value = kSquareTable[first] * alpha + kSquareTable[second] * (1 - alpha);
+    return kSquareRootTable[std::clamp(int(value), 0, kMaxSquare)];
+}
+
+RGBColor MixColors(RGBColor first, RGBColor second, double alpha) {
+    return {MixChannel(first.r, second.r, alpha), MixChannel(first.g, second.g, alpha), MixChannel(first.b, second.b, alpha)};
+}
+
+/// out[i] = MixColors(first[i], second[i], alpha[i]) for a whole run of pixels, bit for bit.
+/// The SSE2 path blends four pixels at once in doubles, the same arithmetic as MixChannel, and takes the
+/// square root in hardware: a float root of an integer up to 255^2 never rounds across an integer
+void MixColorsBatch(const RGBColor* first, const RGBColor* second, const double* alpha, RGBColor* out, size_t count) {
+    static_assert(sizeof(RGBColor) == 3, "RGBColor must be tightly packed");
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d one = _mm_set1_pd(1.0), max_square = _mm_set1_pd(double(kMaxSquare));
+    // 12 channels of 4 pixels as six vectors of 2 doubles: (r0 g0) (b0 r1) (g1 b1) (r2 g2) (b2 r3) (g3 b3)
+    auto load = [&](const RGBColor* pixels, bool whole_vector, __m128d* channels) {
+        __m128i bytes = zero;
+        if (whole_vector) {
+            bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels)); // 4 bytes past the pixels, unused
+        } else {
+            std::memcpy(&bytes, pixels, 4 * sizeof(RGBColor));
+        }
+        __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i words[3] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero), _mm_unpacklo_epi16(high, zero)};
+        for (int k = 0; k < 3; ++k) {
+            channels[2 * k] = _mm_cvtepi32_pd(words[k]);
+            channels[2 * k + 1] = _mm_cvtepi32_pd(_mm_unpackhi_epi64(words[k], words[k]));
+        }
+    };
+    for (; i + 4 <= count; i += 4) {
+        __m128d a[6], b[6];
+        __m128i indices[6];
+        bool whole_vector = i + 6 <= count; // 16 bytes from pixel i stay inside the run
+        load(first + i, whole_vector, a);
+        load(second + i, whole_vector, b);
+        const __m128d weights[6] = {_mm_set1_pd(alpha[i]), _mm_loadu_pd(alpha + i), _mm_set1_pd(alpha[i + 1]),
+                                    _mm_set1_pd(alpha[i + 2]), _mm_loadu_pd(alpha + i + 2), _mm_set1_pd(alpha[i + 3])};
+        for (int k = 0; k < 6; ++k) {
+            __m128d value = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(a[k], a[k]), weights[k]),
+                                       _mm_mul_pd(_mm_mul_pd(b[k], b[k]), _mm_sub_pd(one, weights[k])));
+            value = _mm_min_pd(_mm_max_pd(value, _mm_setzero_pd()), max_square);
+            indices[k] = _mm_cvttpd_epi32(value); // truncated like the table index
+        }
+        __m128i roots[3];
+        for (int k = 0; k < 3; ++k) {
+            __m128i square = _mm_unpacklo_epi64(indices[2 * k], indices[2 * k + 1]);
+            roots[k] = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(square)));
+        }
+        __m128i low = _mm_packs_epi32(roots[0], roots[1]);
+        __m128i high = _mm_packs_epi32(roots[2], zero);
+        __m128i bytes = _mm_packus_epi16(low, high);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), bytes);
+        uint32_t last = uint32_t(_mm_cvtsi128_si32(_mm_srli_si128(bytes, 8)));
+        std::memcpy(reinterpret_cast<uint8_t*>(out + i) + 8, &last, 4);
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = MixColors(first[i], second[i], alpha[i]);
+    }
+}
+
+/// One period of a sin^2 gradient between two colors, sampled at the middle of each step
+struct GradientTable {
+    static constexpr size_t kSize = 1024; // power of two, the phase wraps with a mask
+
+    std::array<RGBColor, kSize> colors;
+    std::array<LinearColor, kSize> linear_colors;
+
+    GradientTable(RGBColor from, RGBColor to) {
+        LinearColor linear_from = ToLinear(from), linear_to = ToLinear(to);
+        for (size_t k = 0; k < kSize; ++k) {
+            double alpha = std::pow(std::sin(M_PI * (k + 0.5) / kSize), 2.0);
+            colors[k] = MixColors(from, to, alpha);
+            linear_colors[k] = MixLinear(linear_from, linear_to, alpha);
+        }
+    }
+
+    /// Entry for sin^2(phase), which repeats every pi
+    static size_t index(double phase) {
+        double position = phase * (kSize / M_PI);
+        auto step = int64_t(position);
+        step -= position < double(step); // floor for negative phases
+        return size_t(step) & (kSize - 1);
+    }
+};
+
+/// The table for the gradient from -> to, shared by every color with the same ends while any of them lives.
+/// Tables are allocated apart from their control blocks so that a dead entry only keeps the block
+std::shared_ptr<const GradientTable> SharedGradientTable(RGBColor from, RGBColor to) {
+    static std::mutex mutex;
+    static std::map<uint64_t, std::weak_ptr<const GradientTable>> tables;
+    static size_t sweep_size = 64;
+    uint64_t key = uint64_t(from.r) << 40 | uint64_t(from.g) << 32 | uint64_t(from.b) << 24 |
+                   uint64_t(to.r) << 16 | uint64_t(to.g) << 8 | uint64_t(to.b);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::weak_ptr<const GradientTable>& entry = tables[key];
+    std::shared_ptr<const GradientTable> table = entry.lock();
+    if (!table) {
+        table.reset(new GradientTable(from, to));
+        entry = table;
+        if (tables.size() >= sweep_size) {
+            for (auto it = tables.begin(); it != tables.end();) {
+                it = it->second.expired() ? tables.erase(it) : std::next(it);
+            }
+            sweep_size = std::max<size_t>(64, 2 * tables.size());
+        }
+    }
+    return table;
+}
+
+// Shading variants with everything decided at compile time. Primitives are instantiated
+// with the exact one they need, see Color::visit. kUsesDistance tells a primitive whether
+// it has to evaluate its distance function just to shade a pixel.
+
+struct FlatColor {
+    static constexpr bool kUsesDistance = false;
+    RGBColor base;
+
+    RGBColor getColor(double, double) const { return base; }
+    LinearColor getLinearColor(double, double) const { return ToLinear(base); }
+    double edgeDistance(double distance, double eps) const { return std::abs(distance - eps); }
+};
+
+struct GradientColor {
+    static constexpr bool kUsesDistance = false;
+    std::shared_ptr<const GradientTable> gradient;
+    double frequency;
+
+    RGBColor getColor(double, double arg) const {
+        return gradient->colors[GradientTable::index(arg * frequency)];
+    }
+    LinearColor getLinearColor(double, double arg) const {
+        return gradient->linear_colors[GradientTable::index(arg * frequency)];
+    }
+    double edgeDistance(double distance, double eps) const { return std::abs(distance - eps); }
+};
+
+struct BorderColor {
+    static constexpr bool kUsesDistance = true;
+    RGBColor base;
+    RGBColor border;
+    double thickness;
+
+    RGBColor getColor(double distance, double) const {
+        return std::abs(distance) < thickness ? border : base;
+    }
+    LinearColor getLinearColor(double distance, double arg) const {
+        return ToLinear(getColor(distance, arg));
+    }
+    /// The border adds a color jump at |distance| == thickness
+    double edgeDistance(double distance, double eps) const {
+        return std::min(std::abs(distance - eps), std::abs(std::abs(distance) - thickness));
+    }
+};
+
+struct GradientBorderColor {
+    static constexpr bool kUsesDistance = true;
+    std::shared_ptr<const GradientTable> gradient;
+    double frequency;
+    RGBColor border;
+    double thickness;
+
+    RGBColor getColor(double distance, double arg) const {
+        if (std::abs(distance) < thickness) {
+            return border;
+        }
+        return gradient->colors[GradientTable::index(arg * frequency)];
+    }
+    LinearColor getLinearColor(double distance, double arg) const {
+        if (std::abs(distance) < thickness) {
+            return ToLinear(border);
+        }
+        return gradient->linear_colors[GradientTable::index(arg * frequency)];
+    }
+    double edgeDistance(double distance, double eps) const {
+        return std::min(std::abs(distance - eps), std::abs(std::abs(distance) - thickness));
+    }
+};
+
+/// A Color as plain data, what scene files store. Fields of a missing gradient or border are zero
+struct ColorRecord {
+    RGBColor base, gradient_to, border;
+    uint8_t has_gradient, has_border;
+    double frequency, thickness;
+};
+
+bool operator==(const ColorRecord& a, const ColorRecord& b) {
+    auto key = [](const ColorRecord& c) {
+        return std::make_tuple(c.base.r, c.base.g, c.base.b, c.gradient_to.r, c.gradient_to.g, c.gradient_to.b,
+                               c.border.r, c.border.g, c.border.b, c.has_gradient, c.has_border,
+                               c.frequency, c.thickness);
+    };
+    return key(a) == key(b);
+}
+
+/// Hashes records by value, so that equal colors can share one entry of a map
+struct ColorRecordHash {
+    size_t operator()(const ColorRecord& c) const {
+        uint64_t rgb = uint64_t(c.base.r) | uint64_t(c.base.g) << 8 | uint64_t(c.base.b) << 16 |
+                       uint64_t(c.gradient_to.r) << 24 | uint64_t(c.gradient_to.g) << 32 |
+                       uint64_t(c.gradient_to.b) << 40 | uint64_t(c.has_gradient) << 48 | uint64_t(c.has_border) << 49;
+        uint64_t hash = rgb * 0x9e3779b97f4a7c15ULL;
+        hash ^= (uint64_t(c.border.r) | uint64_t(c.border.g) << 8 | uint64_t(c.border.b) << 16) + (hash >> 29);
+        hash ^= std::hash<double>()(c.frequency) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        hash ^= std::hash<double>()(c.thickness) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        return size_t(hash * 0xff51afd7ed558ccdULL >> 16);
+    }
+};
+
+/// Distinct records in the order they were first inserted, found through an open addressing hash
+class ColorRecordSet {
+    static constexpr uint32_t kEmpty = ~uint32_t(0);
+
+    std::vector<ColorRecord> records_;
+    std::vector<uint32_t> slots_; // power of two, at most half full
+
+    size_t slotOf(const ColorRecord& record) const {
+        size_t slot = ColorRecordHash()(record) & (slots_.size() - 1);
+        while (slots_[slot] != kEmpty && !(records_[slots_[slot]] == record)) {
+            slot = (slot + 1) & (slots_.size() - 1);
+        }
+        return slot;
+    }
+public:
+    /// Index of the record equal to record, inserted at the end if there is none
+    uint32_t insert(const ColorRecord& record) {
+        if (2 * (records_.size() + 1) > slots_.size()) {
+            slots_.assign(std::max<size_t>(64, 2 * slots_.size()), kEmpty);
+            for (uint32_t id = 0; id < records_.size(); ++id) {
+                slots_[slotOf(records_[id])] = id;
+            }
+        }
+        size_t slot = slotOf(record);
+        if (slots_[slot] == kEmpty) {
+            slots_[slot] = uint32_t(records_.size());
+            records_.push_back(record);
+        }
+        return slots_[slot];
+    }
+
+    const std::vector<ColorRecord>& records() const {
+        return records_;
+    }
+};
+
+/// Any of the shading variants, chosen at runtime.
+/// Primitives built through the Make* factories are specialized on the variant instead
+class Color {
+    RGBColor base_;
+    RGBColor gradient_to_;
+    RGBColor border_;
+    double frequency_;
+    double thickness_;
+
+    bool has_gradient_;
+    bool has_border_;
+
+    std::shared_ptr<const GradientTable> gradient_; // shared by all colors with the same ends
+public:
+    Color(RGBColor base):
+        base_(base),
+        has_gradient_(false),
+        has_border_(false)
+    {}
+
+    Color(RGBColor base, RGBColor gradient_to, double frequency=1.0):
+        base_(base),
+        gradient_to_(gradient_to),
+        frequency_(frequency),
+        has_gradient_(true),
+        has_border_(false),
+        gradient_(SharedGradientTable(base, gradient_to))
+    {}
+
+    // likely not the best way to overload, but it works :)
+    Color(RGBColor base, double thickness, RGBColor border):
+            base_(base),
+            border_(border),
+            thickness_(thickness),
+            has_gradient_(false),
+            has_border_(true)
+    {}
+
+    Color(RGBColor base, RGBColor gradient_to, RGBColor border, double frequency=1.0, double thickness=0.1):
+        base_(base),
+        gradient_to_(gradient_to),
+        border_(border),
+        frequency_(frequency),
+        thickness_(thickness),
+        has_gradient_(true),
+        has_border_(true),
+        gradient_(SharedGradientTable(base, gradient_to))
+    {}
+
+    static Color FromRecord(const ColorRecord& record) {
+        bool gradient = record.has_gradient != 0, border = record.has_border != 0;
+        if (gradient && border) {
+            return Color(record.base, record.gradient_to, record.border, record.frequency, record.thickness);
+        } else if (gradient) {
+            return Color(record.base, record.gradient_to, record.frequency);
+        } else if (border) {
+            return Color(record.base, record.thickness, record.border);
+        }
+        return Color(record.base);
+    }
+
+    ColorRecord record() const {
+        ColorRecord record{};
+        record.base = base_;
+        record.has_gradient = has_gradient_;
+        record.has_border = has_border_;
+        if (has_gradient_) {
+            record.gradient_to = gradient_to_;
+            record.frequency = frequency_;
+        }
+        if (has_border_) {
+            record.border = border_;
+            record.thickness = thickness_;
+        }
+        return record;
+    }
+
+    static constexpr bool kUsesDistance = true;
+
+    /// Calls visitor with the exact shading variant this color describes
+    template<typename Visitor>
+    auto visit(Visitor&& visitor) const {
+        if (has_gradient_ && has_border_) {
+            return visitor(GradientBorderColor{gradient_, frequency_, border_, thickness_});
+        } else if (has_gradient_) {
+            return visitor(GradientColor{gradient_, frequency_});
+        } else if (has_border_) {
+            return visitor(BorderColor{base_, border_, thickness_});
+        } else {
+            return visitor(FlatColor{base_});
+        }
+    }
+
+    /// Whether getColor looks at the distance at all
+    bool usesDistance() const {
+        return has_border_;
+    }
+
+    /// The border's half width, 0 without a border. Edges sit at this distance and at eps
+    double borderThickness() const {
+        return has_border_ ? thickness_ : 0.0;
+    }
+
+    RGBColor getColor(double distance=0.0, double arg=0.0) const {
+        if (has_border_ && std::abs(distance) < thickness_) {
+            return border_;
+        } else if (has_gradient_) {
+            return gradient_->colors[GradientTable::index(arg * frequency_)];
+        } else {
+            return base_;
+        }
+    }
+
+    LinearColor getLinearColor(double distance=0.0, double arg=0.0) const {
+        if (has_border_ && std::abs(distance) < thickness_) {
+            return ToLinear(border_);
+        } else if (has_gradient_) {
+            return gradient_->linear_colors[GradientTable::index(arg * frequency_)];
+        } else {
+            return ToLinear(base_);
+        }
+    }
+
+    double edgeDistance(double distance, double eps) const {
+        if (has_border_) {
+            return std::min(std::abs(distance - eps), std::abs(std::abs(distance) - thickness_));
+        }
+        return std::abs(distance - eps);
+    }
+};
+
+#endif //SDF_COLOR_H
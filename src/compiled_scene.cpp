@@ -0,0 +1 @@
+#include "compiled_scene.h"
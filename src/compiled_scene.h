@@ -0,0 +1,248 @@
+#ifndef SDF_COMPILED_SCENE_H
+#define SDF_COMPILED_SCENE_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_scene.h"
+#include "scene.h"
+#include "scene_builder.h"
+
+// Compiled scene files: a built FlatScene written out as it sits in memory, so a renderer maps
+// the file and renders from it without parsing or building anything.
+//
+// Layout, every section starting at a multiple of kCompiledSceneAlignment:
+//   [CompiledSceneHeader][FlatNode nodes][uint32_t children][ColorRecord colors]
+//   [CompiledTexture textures][uint32_t objects][texture pixels, one run per texture]
+// Files are written and read in the machine's own byte order and struct layout, the header's
+// sizes catch a mismatch. Node contents are trusted: load only files SaveCompiledScene wrote
+
+constexpr uint32_t kCompiledSceneMagic = 0x43534453; // "SDSC"
+constexpr uint32_t kCompiledSceneVersion = 1;
+constexpr size_t kCompiledSceneAlignment = 64;
+
+/// Where an array lies in the file, offset in bytes from the start
+struct CompiledSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct CompiledSceneHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t node_size;  // sizeof(FlatNode) of the writer
+    uint32_t color_size; // sizeof(ColorRecord) of the writer
+    double x_min, x_max, y_min, y_max;
+    RGBColor background;
+    uint8_t padding[5];
+    CompiledSection nodes, children, colors, textures, objects;
+};
+
+/// A baked SDFTexture, its pixels are width * height bytes at pixel_offset
+struct CompiledTexture {
+    int32_t width, height, max_side;
+    uint32_t padding;
+    double border_distance;
+    uint64_t pixel_offset;
+};
+
+static_assert(std::is_trivially_copyable_v<FlatNode> && std::is_trivially_copyable_v<ColorRecord>,
+              "compiled scenes store nodes and colors as raw bytes");
+
+/// Writes the scene builder.build(..., SceneRepresentation::Flat) would make, call optimize() first
+/// to store the optimized graph. Scenes with external nodes can't be compiled
+void SaveCompiledScene(const std::string& path, const SceneBuilder& builder,
+                       double x_min, double x_max, double y_min, double y_max, RGBColor background) {
+    std::vector<NodeId> roots;
+    std::shared_ptr<const FlatScene> scene = builder.buildFlat(&roots);
+    for (const FlatNode& node : scene->nodes) {
+        if (node.kind == NodeKind::Custom) {
+            std::cerr << "Scenes with external nodes can't be compiled" << std::endl;
+            exit(1);
+        }
+    }
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Compiled scene " << path << " failed to open for writing" << std::endl;
+        exit(1);
+    }
+
+    uint64_t position = 0;
+    auto pad = [&]() {
+        static const char zeros[kCompiledSceneAlignment] = {};
+        size_t padding = (kCompiledSceneAlignment - position % kCompiledSceneAlignment) % kCompiledSceneAlignment;
+        std::fwrite(zeros, 1, padding, file);
+        position += padding;
+    };
+    auto write = [&](const void* data, size_t size, size_t count) {
+        pad();
+        CompiledSection section{position, count};
+        std::fwrite(data, size, count, file);
+        position += size * count;
+        return section;
+    };
+
+    CompiledSceneHeader header{};
+    header.magic = kCompiledSceneMagic;
+    header.version = kCompiledSceneVersion;
+    header.node_size = sizeof(FlatNode);
+    header.color_size = sizeof(ColorRecord);
+    header.x_min = x_min;
+    header.x_max = x_max;
+    header.y_min = y_min;
+    header.y_max = y_max;
+    header.background = background;
+    write(&header, sizeof(header), 1);
+
+    // each record once, loading then unpacks every color and bakes every gradient table once
+    ColorRecordSet records;
+    std::vector<uint32_t> color_ids;
+    for (const Color& color : scene->colors) {
+        color_ids.push_back(records.insert(color.record()));
+    }
+    const std::vector<ColorRecord>& colors = records.records();
+    const FlatNode* nodes = scene->nodes.data();
+    std::vector<FlatNode> remapped;
+    if (colors.size() < scene->colors.size()) {
+        remapped.assign(scene->nodes.begin(), scene->nodes.end());
+        for (FlatNode& node : remapped) {
+            if (node.kind != NodeKind::Intersection && node.kind != NodeKind::Overlay) {
+                node.color = color_ids[node.color];
+            }
+        }
+        nodes = remapped.data();
+    }
+    std::vector<uint32_t> objects(roots.begin(), roots.end());
+    std::vector<CompiledTexture> textures;
+    for (const auto& texture : scene->textures) {
+        textures.push_back({texture->width, texture->height, texture->max_side, 0, texture->border_distance, 0});
+    }
+
+    header.nodes = write(nodes, sizeof(FlatNode), scene->nodes.size());
+    header.children = write(scene->children.data(), sizeof(uint32_t), scene->children.size());
+    header.colors = write(colors.data(), sizeof(ColorRecord), colors.size());
+    header.textures = write(textures.data(), sizeof(CompiledTexture), textures.size());
+    header.objects = write(objects.data(), sizeof(uint32_t), objects.size());
+    for (size_t i = 0; i < textures.size(); ++i) {
+        const SharedArray<uint8_t>& pixels = scene->textures[i]->data;
+        textures[i].pixel_offset = write(pixels.data(), 1, pixels.size()).offset;
+    }
+
+    // the texture table and the header again, now that every offset is known
+    std::fseek(file, long(header.textures.offset), SEEK_SET);
+    std::fwrite(textures.data(), sizeof(CompiledTexture), textures.size(), file);
+    std::fseek(file, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, file);
+    if (std::ferror(file) || std::fclose(file) != 0) {
+        std::cerr << "Compiled scene " << path << " failed to write" << std::endl;
+        exit(1);
+    }
+}
+
+/// Whether path starts like a compiled scene file
+bool IsCompiledScene(const std::string& path) {
+    uint32_t magic = 0;
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool read = std::fread(&magic, sizeof(magic), 1, file) == 1;
+    std::fclose(file);
+    return read && magic == kCompiledSceneMagic;
+}
+
+/// Maps a compiled scene file and renders straight from the mapping: nodes, children and texture pixels
+/// are never copied, only the colors are unpacked and the objects get a FlatObject each, all in one allocation.
+/// The mapping lives as long as anything of the scene does
+Scene LoadCompiledScene(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Compiled scene " << path << " failed to open: " << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(CompiledSceneHeader)) {
+        std::cerr << "Compiled scene " << path << " is too short" << std::endl;
+        exit(1);
+    }
+    auto size = size_t(info.st_size);
+    void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        std::cerr << "Compiled scene " << path << " failed to map: " << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+    std::shared_ptr<const void> mapping(address, [size](const void* mapped) {
+        munmap(const_cast<void*>(mapped), size);
+    });
+    auto base = static_cast<const uint8_t*>(address);
+
+    const auto& header = *static_cast<const CompiledSceneHeader*>(address);
+    if (header.magic != kCompiledSceneMagic || header.version != kCompiledSceneVersion ||
+        header.node_size != sizeof(FlatNode) || header.color_size != sizeof(ColorRecord)) {
+        std::cerr << "Compiled scene " << path << " was written by another version or machine" << std::endl;
+        exit(1);
+    }
+    auto section = [&](const CompiledSection& where, size_t element_size) {
+        if (where.offset % kCompiledSceneAlignment != 0 || where.offset > size ||
+            where.count > (size - where.offset) / element_size) {
+            std::cerr << "Compiled scene " << path << " is truncated" << std::endl;
+            exit(1);
+        }
+        return base + where.offset;
+    };
+
+    auto scene = std::make_shared<FlatScene>();
+    scene->nodes = SharedArray<FlatNode>(reinterpret_cast<const FlatNode*>(section(header.nodes, sizeof(FlatNode))),
+                                         header.nodes.count, mapping);
+    scene->children = SharedArray<uint32_t>(reinterpret_cast<const uint32_t*>(section(header.children, sizeof(uint32_t))),
+                                            header.children.count, mapping);
+    auto colors = reinterpret_cast<const ColorRecord*>(section(header.colors, sizeof(ColorRecord)));
+    scene->colors.reserve(header.colors.count);
+    for (size_t i = 0; i < header.colors.count; ++i) {
+        scene->colors.push_back(Color::FromRecord(colors[i]));
+    }
+    auto textures = reinterpret_cast<const CompiledTexture*>(section(header.textures, sizeof(CompiledTexture)));
+    for (size_t i = 0; i < header.textures.count; ++i) {
+        const CompiledTexture& compiled = textures[i];
+        auto pixels = size_t(compiled.width) * size_t(compiled.height);
+        if (compiled.pixel_offset > size || pixels > size - compiled.pixel_offset) {
+            std::cerr << "Compiled scene " << path << " is truncated" << std::endl;
+            exit(1);
+        }
+        auto texture = std::make_shared<SDFTexture>();
+        texture->width = compiled.width;
+        texture->height = compiled.height;
+        texture->max_side = compiled.max_side;
+        texture->border_distance = compiled.border_distance;
+        texture->data = SharedArray<uint8_t>(base + compiled.pixel_offset, pixels, mapping);
+        scene->textures.push_back(std::move(texture));
+    }
+
+    auto roots = reinterpret_cast<const uint32_t*>(section(header.objects, sizeof(uint32_t)));
+    // all objects in one allocation, the scene holds aliasing pointers into it like with NodeArena
+    auto objects = std::make_shared<std::vector<FlatObject>>();
+    objects->reserve(header.objects.count);
+    std::vector<std::shared_ptr<SDF>> pointers;
+    pointers.reserve(header.objects.count);
+    for (size_t i = 0; i < header.objects.count; ++i) {
+        objects->emplace_back(scene, roots[i]);
+        pointers.emplace_back(objects, &objects->back());
+    }
+    return Scene(pointers, header.x_min, header.x_max, header.y_min, header.y_max, header.background);
+}
+
+#endif //SDF_COMPILED_SCENE_H
@@ -6,121 +6,296 @@
 #include <memory>
 #include <utility>
 #include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
 
-struct RGBColor {
-    uint8_t r, g, b;
+#include "bounds.h"
+#include "color.h"
+#include "shared_array.h"
+
+class SDF {
+public:
+    SDF() = default;
+    virtual double distance(double x, double y) = 0;
+    virtual ~SDF() = default;
+    virtual RGBColor getColor(double x, double y) = 0;
+    /// Unquantized color for the float pipeline
+    virtual LinearColor getLinearColor(double x, double y) {
+        return ToLinear(getColor(x, y));
+    }
+    /// How far the point is from the closest place where the rendered color jumps,
+    /// i.e. where some distance crosses eps. Composites also report the seams between their children
+    virtual double edgeDistance(double x, double y, double eps) {
+        return std::abs(distance(x, y) - eps);
+    }
+    /// Box the shape lies in: outside of it distance() is at least the distance to the box.
+    /// The whole plane is always right, shapes that know better say so
+    virtual Bounds bounds() const {
+        return Bounds::Everything();
+    }
+    /// Distances of many points at once, out[k] = distance(xs[k], ys[k]).
+    /// Batched distance queries call this once per object and batch of points
+    virtual void distances(const double* xs, const double* ys, size_t count, double* out) {
+        for (size_t k = 0; k < count; ++k) {
+            out[k] = distance(xs[k], ys[k]);
+        }
+    }
+    /// Colors of many points at once, distances[k] must be distance(xs[k], ys[k]).
+    /// Deferred shading calls this with the distances its coverage pass already computed
+    virtual void getColors(const double* xs, const double* ys, const double* distances, size_t count, RGBColor* out) {
+        for (size_t k = 0; k < count; ++k) {
+            out[k] = getColor(xs[k], ys[k]);
+        }
+    }
+    virtual void getLinearColors(const double* xs, const double* ys, const double* distances, size_t count,
+                                 LinearColor* out) {
+        for (size_t k = 0; k < count; ++k) {
+            out[k] = getLinearColor(xs[k], ys[k]);
+        }
+    }
 };
 
-RGBColor MixColors(RGBColor first, RGBColor second, double alpha) {
-    return {
-            uint8_t(sqrt(double(first.r) * double(first.r) * alpha + double(second.r) * double(second.r) * (1 - alpha))),
-            uint8_t(sqrt(double(first.g) * double(first.g) * alpha + double(second.g) * double(second.g) * (1 - alpha))),
-            uint8_t(sqrt(double(first.b) * double(first.b) * alpha + double(second.b) * double(second.b) * (1 - alpha)))
-    };
+// Distance functions of the primitives. The SDF classes below and FlatScene share them
+
+double CircleDistance(double x, double y, double center_x, double center_y, double radius) {
+    return std::sqrt((x - center_x) * (x - center_x) + (y - center_y) * (y - center_y)) - radius;
 }
 
-class Color {
-    RGBColor base_;
-    RGBColor gradient_to_;
-    RGBColor border_;
-    double frequency_;
-    double thickness_;
+double AxisAlignedRectangleDistance(double x, double y, double center_x, double center_y, double width, double height) {
+    double dx = std::abs(x - center_x) - width;
+    double dy = std::abs(y - center_y) - height;
 
-    bool has_gradient_;
-    bool has_border_;
-public:
-    Color(RGBColor base):
-        base_(base),
-        has_gradient_(false),
-        has_border_(false)
-    {}
+    return std::sqrt(std::max(dx, 0.0) * std::max(dx, 0.0) + std::max(dy, 0.0) * std::max(dy, 0.0)) + std::min(std::max(dx, dy), 0.0);
+}
 
-    Color(RGBColor base, RGBColor gradient_to, double frequency=1.0):
-        base_(base),
-        gradient_to_(gradient_to),
-        frequency_(frequency),
-        has_gradient_(true),
-        has_border_(false)
-    {}
+double SegmentDistance(double x, double y, double a_x, double a_y, double b_x, double b_y) {
+    double dx = x - a_x;
+    double dy = y - a_y;
+    double bax = b_x - a_x;
+    double bay = b_y - a_y;
 
-    // likely not the best way to overload, but it works :)
-    Color(RGBColor base, double thickness, RGBColor border):
-            base_(base),
-            border_(border),
-            thickness_(thickness),
-            has_gradient_(false),
-            has_border_(true)
-    {}
+    double h = std::clamp((dx * bax + dy * bay) / (bax * bax + bay * bay), 0.0, 1.0);
+    return std::sqrt((dx - bax * h) * (dx - bax * h) + (dy - bay * h) * (dy - bay * h));
+}
 
-    Color(RGBColor base, RGBColor gradient_to, RGBColor border, double frequency=1.0, double thickness=0.1):
-        base_(base),
-        gradient_to_(gradient_to),
-        border_(border),
-        frequency_(frequency),
-        thickness_(thickness),
-        has_gradient_(true),
-        has_border_(true)
-    {}
+/// radius is the triangle's side / 2, i.e. 2 / sqrt(3) times the radius the shape was created with
+double AxisAlignedEquilateralTriangleDistance(double x, double y, double center_x, double center_y, double radius) {
+    double k = std::sqrt(3.0);
 
-    RGBColor getColor(double distance=0.0, double arg=0.0) {
-        if (has_border_ && std::abs(distance) < thickness_) {
-            return border_;
-        } else if (has_gradient_) {
-            return MixColors(base_, gradient_to_, std::pow(std::sin(arg * frequency_), 2.0));
+    double dx = std::abs(x - center_x) - radius;
+    double dy = center_y - y + radius / k + radius / std::sqrt(3) / 2;
+
+    if (dx + k * dy > 0.0) {
+        double tmp = dx;
+        dx = (dx - k * dy) / 2.0;
+        dy = (-k * tmp - dy) / 2.0;
+    }
+    dx -= std::clamp(dx, -2.0 * radius, 0.0);
+
+    return (dy > 0.0 ? -1.0 : 1.0) * std::sqrt(dx * dx + dy * dy);
+}
+
+// Bounds of the primitives, same parameters as their distance functions
+
+Bounds CircleBounds(double center_x, double center_y, double radius) {
+    return {center_x - radius, center_x + radius, center_y - radius, center_y + radius};
+}
+
+Bounds AxisAlignedRectangleBounds(double center_x, double center_y, double width, double height) {
+    return {center_x - width, center_x + width, center_y - height, center_y + height};
+}
+
+Bounds SegmentBounds(double a_x, double a_y, double b_x, double b_y) {
+    return {std::min(a_x, b_x), std::max(a_x, b_x), std::min(a_y, b_y), std::max(a_y, b_y)};
+}
+
+/// radius as in AxisAlignedEquilateralTriangleDistance, the triangle is sqrt(3) * radius high
+Bounds AxisAlignedEquilateralTriangleBounds(double center_x, double center_y, double radius) {
+    if (radius < 0) {
+        return Bounds::Everything();
+    }
+    double half_height = radius * std::sqrt(3.0) / 2;
+    return {center_x - radius, center_x + radius, center_y - half_height, center_y + half_height};
+}
+
+/// Single channel distance texture, 128 is the edge. Shared by all SDFImages showing it
+struct SDFTexture {
+    int width = 0, height = 0;
+    int max_side = 0;
+    SharedArray<uint8_t> data;     // height rows of width pixels
+    double border_distance = 0.0; // smallest distance on the image's border, at least 0
+
+    uint8_t getPixel(size_t i, size_t j) const {
+        if (i < height && j < width) {
+            return data[i * width + j];
         } else {
-            return base_;
+            return 0;
         }
     }
+
+    /// Distance at (x, y) relative to the image's corner at the given scale.
+    /// Outside the image it grows from border_distance with the distance to the image,
+    /// so it never drops below the distance to the image's rectangle
+    double distance(double ix, double iy, double scale) const {
+        double image_width = scale * width / max_side;
+        double image_height = scale * height / max_side;
+        if (ix < 0 || iy < 0 || ix >= image_width || iy >= image_height) {
+            double dx = std::max({-ix, ix - image_width, 0.0});
+            double dy = std::max({-iy, iy - image_height, 0.0});
+            return border_distance + std::sqrt(dx * dx + dy * dy);
+        } else {
+            // bilinear interpolation
+            ix *= max_side / scale;
+            iy *= max_side / scale;
+            double interp_x = std::modf(ix, &ix);
+            double interp_y = std::modf(iy, &iy);
+
+            double pixels[4] = {
+                    static_cast<double>(getPixel(static_cast<size_t>(iy    ), static_cast<size_t>(ix    ))),
+                    static_cast<double>(getPixel(static_cast<size_t>(iy    ), static_cast<size_t>(ix + 1))),
+                    static_cast<double>(getPixel(static_cast<size_t>(iy + 1), static_cast<size_t>(ix    ))),
+                    static_cast<double>(getPixel(static_cast<size_t>(iy + 1), static_cast<size_t>(ix + 1)))
+            };
+            double value = pixels[0] * (1 - interp_y) * (1 - interp_x) +
+                           pixels[1] * (1 - interp_y) * (    interp_x) +
+                           pixels[2] * (    interp_y) * (1 - interp_x) +
+                           pixels[3] * (    interp_y) * (    interp_x);
+            return (128. - value) / 255.;
+        }
+    }
+
+    /// The image's rectangle with its corner at (left, top)
+    Bounds bounds(double left, double top, double scale) const {
+        return {left, left + scale * width / max_side, top, top + scale * height / max_side};
+    }
 };
 
-class SDF {
+std::shared_ptr<const SDFTexture> LoadSDFTexture(const std::string& filepath) {
+    auto texture = std::make_shared<SDFTexture>();
+    int channels;
+    uint8_t* data = stbi_load(filepath.c_str(), &texture->width, &texture->height, &channels, 1);
+    if (data == nullptr) {
+        std::cerr << "Image failed to load" << std::endl;
+        exit(1);
+    }
+    texture->max_side = std::max(texture->width, texture->height);
+    texture->data = SharedArray<uint8_t>(std::vector<uint8_t>(data, data + size_t(texture->width) * texture->height));
+    stbi_image_free(data);
+    uint8_t border_max = 0;
+    for (int j = 0; j < texture->width; ++j) {
+        border_max = std::max({border_max, texture->getPixel(0, j), texture->getPixel(texture->height - 1, j)});
+    }
+    for (int i = 0; i < texture->height; ++i) {
+        border_max = std::max({border_max, texture->getPixel(i, 0), texture->getPixel(i, texture->width - 1)});
+    }
+    texture->border_distance = std::max((128. - border_max) / 255., 0.0);
+    return texture;
+}
+
+/// Shading shared by the primitives that take a Color. Derived provides distance() and shadingArg(),
+/// the coordinate a gradient runs along. Derived is final, so neither goes through the vtable
+template <typename Derived, typename ColorT>
+class ShadedPrimitive: public SDF {
+protected:
+    ColorT color_;
+
+    explicit ShadedPrimitive(ColorT color): color_(std::move(color)) {}
+private:
+    Derived& self() {
+        return static_cast<Derived&>(*this);
+    }
 public:
-    SDF() = default;
-    virtual double distance(double x, double y) = 0;
-    virtual ~SDF() = default;
-    virtual RGBColor getColor(double x, double y) = 0;
+    RGBColor getColor(double x, double y) override {
+        return color_.getColor(ColorT::kUsesDistance ? self().distance(x, y) : 0.0, self().shadingArg(x, y));
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        return color_.getLinearColor(ColorT::kUsesDistance ? self().distance(x, y) : 0.0, self().shadingArg(x, y));
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        return color_.edgeDistance(self().distance(x, y), eps);
+    }
+
+    void getColors(const double* xs, const double* ys, const double* distances, size_t count, RGBColor* out) override {
+        for (size_t k = 0; k < count; ++k) {
+            out[k] = color_.getColor(distances[k], self().shadingArg(xs[k], ys[k]));
+        }
+    }
+
+    void getLinearColors(const double* xs, const double* ys, const double* distances, size_t count,
+                         LinearColor* out) override {
+        for (size_t k = 0; k < count; ++k) {
+            out[k] = color_.getLinearColor(distances[k], self().shadingArg(xs[k], ys[k]));
+        }
+    }
 };
 
-class Circle: public SDF {
+template <typename ColorT>
+class BasicCircle final: public ShadedPrimitive<BasicCircle<ColorT>, ColorT> {
     double x_, y_;
     double radius_;
-    Color color_;
 public:
-    Circle(double x, double y, double radius, Color color): x_(x), y_(y), radius_(radius), color_(color) {}
+    BasicCircle(double x, double y, double radius, ColorT color):
+        ShadedPrimitive<BasicCircle<ColorT>, ColorT>(color), x_(x), y_(y), radius_(radius) {}
     double distance(double x, double y) override {
-        return std::sqrt((x - x_) * (x - x_) + (y - y_) * (y - y_)) - radius_;
+        return CircleDistance(x, y, x_, y_, radius_);
     }
-    RGBColor getColor(double x, double y) override {
-        return color_.getColor(distance(x, y), x - x_ - radius_);
+    double shadingArg(double x, double y) const {
+        return x - x_ - radius_;
+    }
+
+    Bounds bounds() const override {
+        return CircleBounds(x_, y_, radius_);
     }
 };
 
-class AxisAlignedRectangle: public SDF {
+using Circle = BasicCircle<Color>;
+
+/// Circle instantiated with the exact shading variant of color
+std::shared_ptr<SDF> MakeCircle(double x, double y, double radius, const Color& color) {
+    return color.visit([&](auto shading) -> std::shared_ptr<SDF> {
+        return std::make_shared<BasicCircle<decltype(shading)>>(x, y, radius, shading);
+    });
+}
+
+template <typename ColorT>
+class BasicAxisAlignedRectangle final: public ShadedPrimitive<BasicAxisAlignedRectangle<ColorT>, ColorT> {
     double x_, y_;
     double width_, height_;
-    Color color_;
 public:
-    AxisAlignedRectangle(double x, double y, double width, double height, Color color):
+    BasicAxisAlignedRectangle(double x, double y, double width, double height, ColorT color):
+        ShadedPrimitive<BasicAxisAlignedRectangle<ColorT>, ColorT>(color),
         x_(x),
         y_(y),
         width_(width),
-        height_(height),
-        color_(color)
+        height_(height)
     {}
 
     double distance(double x, double y) override {
-        double dx = std::abs(x - x_) - width_;
-        double dy = std::abs(y - y_) - height_;
+        return AxisAlignedRectangleDistance(x, y, x_, y_, width_, height_);
+    }
 
-        return std::sqrt(std::max(dx, 0.0) * std::max(dx, 0.0) + std::max(dy, 0.0) * std::max(dy, 0.0)) + std::min(std::max(dx, dy), 0.0);
+    double shadingArg(double x, double y) const {
+        return y - y_ - height_;
     }
 
-    RGBColor getColor(double x, double y) override {
-        return color_.getColor(distance(x, y), y - y_ - height_);
+    Bounds bounds() const override {
+        return AxisAlignedRectangleBounds(x_, y_, width_, height_);
     }
 };
 
-class Segment: public SDF {
+using AxisAlignedRectangle = BasicAxisAlignedRectangle<Color>;
+
+/// AxisAlignedRectangle instantiated with the exact shading variant of color
+std::shared_ptr<SDF> MakeAxisAlignedRectangle(double x, double y, double width, double height, const Color& color) {
+    return color.visit([&](auto shading) -> std::shared_ptr<SDF> {
+        return std::make_shared<BasicAxisAlignedRectangle<decltype(shading)>>(x, y, width, height, shading);
+    });
+}
+
+class Segment final: public SDF {
     double a_x_, a_y_, b_x_, b_y_;
     RGBColor color_;
 public:
@@ -133,115 +308,90 @@ public:
     {}
 
     double distance(double x, double y) override {
-        double dx = x - a_x_;
-        double dy = y - a_y_;
-        double bax = b_x_ - a_x_;
-        double bay = b_y_ - a_y_;
-
-        double h = std::clamp((dx * bax + dy * bay) / (bax * bax + bay * bay), 0.0, 1.0);
-        return std::sqrt((dx - bax * h) * (dx - bax * h) + (dy - bay * h) * (dy - bay * h));
+        return SegmentDistance(x, y, a_x_, a_y_, b_x_, b_y_);
     }
 
     RGBColor getColor(double x, double y) override {
         return color_;
     }
 
+    Bounds bounds() const override {
+        return SegmentBounds(a_x_, a_y_, b_x_, b_y_);
+    }
 };
 
-class AxisAlignedEquilateralTriangle: public SDF {
+template <typename ColorT>
+class BasicAxisAlignedEquilateralTriangle final: public ShadedPrimitive<BasicAxisAlignedEquilateralTriangle<ColorT>, ColorT> {
     double x_, y_;
     double radius_;
-    Color color_;
 public:
-    AxisAlignedEquilateralTriangle(double x, double y, double radius, Color color):
+    BasicAxisAlignedEquilateralTriangle(double x, double y, double radius, ColorT color):
+        ShadedPrimitive<BasicAxisAlignedEquilateralTriangle<ColorT>, ColorT>(color),
         x_(x),
         y_(y),
-        radius_(radius * 2 / std::sqrt(3)),
-        color_(color)
+        radius_(radius * 2 / std::sqrt(3))
     {}
 
     double distance(double x, double y) override {
-        double k = std::sqrt(3.0);
-
-        double dx = std::abs(x - x_) - radius_;
-        double dy = y_ - y + radius_ / k + radius_ / std::sqrt(3) / 2;
-
-        if (dx + k * dy > 0.0) {
-            double tmp = dx;
-            dx = (dx - k * dy) / 2.0;
-            dy = (-k * tmp - dy) / 2.0;
-        }
-        dx -= std::clamp(dx, -2.0 * radius_, 0.0);
+        return AxisAlignedEquilateralTriangleDistance(x, y, x_, y_, radius_);
+    }
 
-        return (dy > 0.0 ? -1.0 : 1.0) * std::sqrt(dx * dx + dy * dy);
+    double shadingArg(double x, double y) const {
+        return y - y_ - radius_;
     }
 
-    RGBColor getColor(double x, double y) override {
-        return color_.getColor(distance(x, y), y - y_ - radius_);
+    Bounds bounds() const override {
+        return AxisAlignedEquilateralTriangleBounds(x_, y_, radius_);
     }
 };
 
-class SDFImage: public SDF {
+using AxisAlignedEquilateralTriangle = BasicAxisAlignedEquilateralTriangle<Color>;
+
+/// AxisAlignedEquilateralTriangle instantiated with the exact shading variant of color
+std::shared_ptr<SDF> MakeAxisAlignedEquilateralTriangle(double x, double y, double radius, const Color& color) {
+    return color.visit([&](auto shading) -> std::shared_ptr<SDF> {
+        return std::make_shared<BasicAxisAlignedEquilateralTriangle<decltype(shading)>>(x, y, radius, shading);
+    });
+}
+
+template <typename ColorT>
+class BasicSDFImage final: public ShadedPrimitive<BasicSDFImage<ColorT>, ColorT> {
     double x_, y_;
     double scale_;
-    Color color_;
 
-    int width_, height_;
-    int max_side_;
-    uint8_t* data_;
-
-    uint8_t getPixel(size_t i, size_t j) {
-        if (i < height_ && j < width_) {
-            return data_[i * width_ + j];
-        } else {
-            return 0;
-        }
-    }
+    std::shared_ptr<const SDFTexture> texture_;
 public:
-    SDFImage(const std::string& filepath, double x, double y, double scale, Color color): x_(x), y_(y), scale_(scale),
-                                                                                          color_(color) {
-        int channels;
-        data_ = stbi_load(filepath.c_str(), &width_, &height_, &channels, 1);
-        max_side_ = std::max(width_, height_);
-        if (data_ == nullptr) {
-            std::cerr << "Image failed to load" << std::endl;
-            exit(1);
-        }
-        x_ = x_ - scale_ * width_ / max_side_ / 2;
-        y_ = y_ - scale_ * height_ / max_side_ / 2;
+    BasicSDFImage(std::shared_ptr<const SDFTexture> texture, double x, double y, double scale, ColorT color):
+            ShadedPrimitive<BasicSDFImage<ColorT>, ColorT>(color), x_(x), y_(y), scale_(scale), texture_(std::move(texture)) {
+        x_ = x_ - scale_ * texture_->width / texture_->max_side / 2;
+        y_ = y_ - scale_ * texture_->height / texture_->max_side / 2;
     }
 
+    BasicSDFImage(const std::string& filepath, double x, double y, double scale, ColorT color):
+            BasicSDFImage(LoadSDFTexture(filepath), x, y, scale, color) {}
+
     double distance(double x, double y) override {
-        double ix = x - x_;
-        double iy = y - y_;
-        if (ix < 0 || iy < 0 || ix >= scale_ * width_ / max_side_ || iy >= scale_ * height_ / max_side_) {
-            return 1.0;
-        } else {
-            // bilinear interpolation
-            ix *= max_side_ / scale_;
-            iy *= max_side_ / scale_;
-            double interp_x = std::modf(ix, &ix);
-            double interp_y = std::modf(iy, &iy);
+        return texture_->distance(x - x_, y - y_, scale_);
+    }
 
-            double pixels[4] = {
-                    static_cast<double>(getPixel(static_cast<size_t>(iy    ), static_cast<size_t>(ix    ))),
-                    static_cast<double>(getPixel(static_cast<size_t>(iy    ), static_cast<size_t>(ix + 1))),
-                    static_cast<double>(getPixel(static_cast<size_t>(iy + 1), static_cast<size_t>(ix    ))),
-                    static_cast<double>(getPixel(static_cast<size_t>(iy + 1), static_cast<size_t>(ix + 1)))
-            };
-            double value = pixels[0] * (1 - interp_y) * (1 - interp_x) +
-                           pixels[1] * (1 - interp_y) * (    interp_x) +
-                           pixels[2] * (    interp_y) * (1 - interp_x) +
-                           pixels[3] * (    interp_y) * (    interp_x);
-            return (128. - value) / 255.;
-        }
+    double shadingArg(double x, double y) const {
+        return y - y_ - scale_;
     }
 
-    RGBColor getColor(double x, double y) override {
-        return color_.getColor(distance(x, y), y - y_ - scale_);
+    Bounds bounds() const override {
+        return texture_->bounds(x_, y_, scale_);
     }
 };
 
+using SDFImage = BasicSDFImage<Color>;
+
+/// SDFImage instantiated with the exact shading variant of color
+std::shared_ptr<SDF> MakeSDFImage(const std::string& filepath, double x, double y, double scale, const Color& color) {
+    return color.visit([&](auto shading) -> std::shared_ptr<SDF> {
+        return std::make_shared<BasicSDFImage<decltype(shading)>>(filepath, x, y, scale, shading);
+    });
+}
+
 double sminCubic(double a, double b, double k)
 {
     double h = std::max( k-abs(a-b), 0.0 )/k;
@@ -250,6 +400,11 @@ double sminCubic(double a, double b, double k)
     return (a<b) ? a-s : b-s;
 }
 
+/// How far sminCubic can dip below the smaller of its arguments
+double SmoothBlendPadding(double k) {
+    return k / 6;
+}
+
 double sminCubicCol(double a, double b, double k)
 {
     double h = std::max( k-abs(a-b), 0.0 )/k;
@@ -258,14 +413,41 @@ double sminCubicCol(double a, double b, double k)
     return (a<b) ? m : 1-m;
 }
 
-class Intersection: public SDF {
-    std::shared_ptr<SDF> first_;
-    std::shared_ptr<SDF> second_;
+/// Overlay blends its children where both are closer than this
+constexpr double kOverlayEps = 2e-3;
+
+// Composites are templates over how they hold their children: std::shared_ptr<SDF> for
+// scenes put together by hand, ArenaRef for scenes made by SceneBuilder. ChildRef only needs operator->
+
+/// child->getColors on the points picked out by indices, written back to their places in out
+template <typename ChildRef>
+void ShadePicked(const ChildRef& child, const std::vector<uint32_t>& indices, const double* xs, const double* ys,
+                 const double* distances, RGBColor* out) {
+    if (indices.empty()) {
+        return;
+    }
+    size_t count = indices.size();
+    std::vector<double> picked(3 * count);
+    std::vector<RGBColor> colors(count);
+    for (size_t k = 0; k < count; ++k) {
+        picked[k] = xs[indices[k]];
+        picked[count + k] = ys[indices[k]];
+        picked[2 * count + k] = distances[indices[k]];
+    }
+    child->getColors(picked.data(), picked.data() + count, picked.data() + 2 * count, count, colors.data());
+    for (size_t k = 0; k < count; ++k) {
+        out[indices[k]] = colors[k];
+    }
+}
+
+template <typename ChildRef>
+class BasicIntersection: public SDF {
+    ChildRef first_;
+    ChildRef second_;
     bool smooth_;
     double smoothness_;
 public:
-    Intersection(std::shared_ptr<SDF>&& first, std::shared_ptr<SDF>&& second,
-                 bool smooth=false, double smoothness=0.125):
+    BasicIntersection(ChildRef first, ChildRef second, bool smooth=false, double smoothness=0.125):
          first_(std::move(first)),
          second_(std::move(second)),
          smooth_(smooth),
@@ -296,14 +478,66 @@ public:
             }
         }
     }
+
+    /// getColor for a batch: the children's distances and colors come in batches too, and smooth blends
+    /// go through MixColorsBatch. Scratch lives on the heap, composites nest as deep as their scenes
+    void getColors(const double* xs, const double* ys, const double* distances, size_t count, RGBColor* out) override {
+        std::vector<double> first_dist(count), second_dist(count);
+        first_->distances(xs, ys, count, first_dist.data());
+        second_->distances(xs, ys, count, second_dist.data());
+        if (smooth_) {
+            std::vector<RGBColor> first_colors(count), second_colors(count);
+            first_->getColors(xs, ys, first_dist.data(), count, first_colors.data());
+            second_->getColors(xs, ys, second_dist.data(), count, second_colors.data());
+            std::vector<double> blend(count);
+            for (size_t k = 0; k < count; ++k) {
+                blend[k] = sminCubicCol(second_dist[k], first_dist[k], smoothness_);
+            }
+            MixColorsBatch(first_colors.data(), second_colors.data(), blend.data(), out, count);
+        } else {
+            // each child shades only the points it is closer to
+            std::vector<uint32_t> first_points, second_points;
+            for (size_t k = 0; k < count; ++k) {
+                (first_dist[k] < second_dist[k] ? first_points : second_points).push_back(uint32_t(k));
+            }
+            ShadePicked(first_, first_points, xs, ys, first_dist.data(), out);
+            ShadePicked(second_, second_points, xs, ys, second_dist.data(), out);
+        }
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        double first_dist = first_->distance(x, y);
+        double second_dist = second_->distance(x, y);
+        if (smooth_) {
+            double blend = sminCubicCol(second_dist, first_dist, smoothness_);
+            return MixLinear(first_->getLinearColor(x, y), second_->getLinearColor(x, y), blend);
+        } else {
+            if (first_dist < second_dist) {
+                return first_->getLinearColor(x, y);
+            } else {
+                return second_->getLinearColor(x, y);
+            }
+        }
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        double children = std::min(first_->edgeDistance(x, y, eps), second_->edgeDistance(x, y, eps));
+        return smooth_ ? std::min(std::abs(distance(x, y) - eps), children) : children;
+    }
+
+    Bounds bounds() const override {
+        Bounds children = first_->bounds().united(second_->bounds());
+        return smooth_ ? children.padded(SmoothBlendPadding(smoothness_)) : children;
+    }
 };
 
-class Overlay: public SDF {
-    std::shared_ptr<SDF> top_;
-    std::shared_ptr<SDF> bottom_;
+template <typename ChildRef>
+class BasicOverlay: public SDF {
+    ChildRef top_;
+    ChildRef bottom_;
     double alpha_;
 public:
-    Overlay(std::shared_ptr<SDF>&& top, std::shared_ptr<SDF>&& bottom, double alpha=0.5):
+    BasicOverlay(ChildRef top, ChildRef bottom, double alpha=0.5):
         top_(std::move(top)),
         bottom_(std::move(bottom)),
         alpha_(alpha)
@@ -321,7 +555,7 @@ public:
         RGBColor bottom_color = bottom_->getColor(x, y);
 
         // TODO: move to get color definition
-        double eps = 2e-3;
+        double eps = kOverlayEps;
         if (top_dist < eps && bottom_dist < eps) {
             return MixColors(top_color, bottom_color, alpha_);
         } else if (bottom_dist < eps) {
@@ -330,6 +564,53 @@ public:
             return top_color;
         }
     }
+
+    /// getColor for a batch, both children shade every point like there and the blends go through MixColorsBatch
+    void getColors(const double* xs, const double* ys, const double* distances, size_t count, RGBColor* out) override {
+        std::vector<double> top_dist(count), bottom_dist(count);
+        top_->distances(xs, ys, count, top_dist.data());
+        bottom_->distances(xs, ys, count, bottom_dist.data());
+        std::vector<RGBColor> top_colors(count), bottom_colors(count), mixed(count);
+        top_->getColors(xs, ys, top_dist.data(), count, top_colors.data());
+        bottom_->getColors(xs, ys, bottom_dist.data(), count, bottom_colors.data());
+        std::vector<double> alpha(count, alpha_);
+        MixColorsBatch(top_colors.data(), bottom_colors.data(), alpha.data(), mixed.data(), count);
+        double eps = kOverlayEps;
+        for (size_t k = 0; k < count; ++k) {
+            if (top_dist[k] < eps && bottom_dist[k] < eps) {
+                out[k] = mixed[k];
+            } else if (bottom_dist[k] < eps) {
+                out[k] = bottom_colors[k];
+            } else {
+                out[k] = top_colors[k];
+            }
+        }
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        double top_dist = top_->distance(x, y);
+        double bottom_dist = bottom_->distance(x, y);
+
+        double eps = kOverlayEps;
+        if (top_dist < eps && bottom_dist < eps) {
+            return MixLinear(top_->getLinearColor(x, y), bottom_->getLinearColor(x, y), alpha_);
+        } else if (bottom_dist < eps) {
+            return bottom_->getLinearColor(x, y);
+        } else {
+            return top_->getLinearColor(x, y);
+        }
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        return std::min(top_->edgeDistance(x, y, eps), bottom_->edgeDistance(x, y, eps));
+    }
+
+    Bounds bounds() const override {
+        return top_->bounds().united(bottom_->bounds());
+    }
 };
 
+using Intersection = BasicIntersection<std::shared_ptr<SDF>>;
+using Overlay = BasicOverlay<std::shared_ptr<SDF>>;
+
 #endif //SDF_DISTANCE_FUNCTIONS_H
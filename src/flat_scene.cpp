@@ -0,0 +1 @@
+#include "flat_scene.h"
@@ -0,0 +1,435 @@
+#ifndef SDF_FLAT_SCENE_H
+#define SDF_FLAT_SCENE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "distance_functions.h"
+#include "primitive_shapes.h"
+
+/// The closed set of node types, plus Custom for everything else
+enum class NodeKind : uint8_t {
+    Circle,
+    AxisAlignedRectangle,
+    Segment,
+    AxisAlignedEquilateralTriangle,
+    SDFImage,
+    Intersection,
+    Overlay,
+    Custom, // a user defined SDF, evaluated through its virtual functions
+};
+
+/// One node of a FlatScene. Plain data, the kind decides what params mean:
+///   Circle                          x, y, radius
+///   AxisAlignedRectangle            x, y, width, height
+///   Segment                         a_x, a_y, b_x, b_y
+///   AxisAlignedEquilateralTriangle  x, y, radius, radius * 2 / sqrt(3)
+///   SDFImage                        x, y, scale, left, top
+///   Intersection                    smoothness
+///   Overlay                         alpha
+struct FlatNode {
+    NodeKind kind = NodeKind::Custom;
+    bool smooth = false;       // Intersection
+    uint32_t color = 0;        // primitives, index into FlatScene::colors
+    uint32_t resource = 0;     // SDFImage: index into textures, Custom: index into custom
+    uint32_t first_child = 0;  // composites, range of FlatScene::children
+    uint32_t child_count = 0;
+    uint32_t subtree_end = 0;  // the node's subtree is [its index, subtree_end)
+    double params[5] = {};
+};
+
+/// Bounds of a primitive node, texture is the texture of an SDFImage
+Bounds PrimitiveBounds(const FlatNode& node, const SDFTexture* texture) {
+    const double* p = node.params;
+    switch (node.kind) {
+        case NodeKind::Circle:
+            return CircleBounds(p[0], p[1], p[2]);
+        case NodeKind::AxisAlignedRectangle:
+            return AxisAlignedRectangleBounds(p[0], p[1], p[2], p[3]);
+        case NodeKind::Segment:
+            return SegmentBounds(p[0], p[1], p[2], p[3]);
+        case NodeKind::AxisAlignedEquilateralTriangle:
+            return AxisAlignedEquilateralTriangleBounds(p[0], p[1], p[3]);
+        case NodeKind::SDFImage:
+            return texture->bounds(p[3], p[4], p[2]);
+        default:
+            return Bounds::Everything();
+    }
+}
+
+/// A whole scene as arrays of nodes, evaluated with a switch instead of virtual calls.
+/// Nodes are stored depth first, every subtree is a contiguous range and children come after
+/// their parent, so one backwards sweep over the range computes all distances of a subtree
+/// without recursion. Shading then reads the children's distances from that sweep.
+/// Intersections take any number of children and fold them left to right, exactly like a chain of binary ones
+struct FlatScene {
+    SharedArray<FlatNode> nodes;
+    SharedArray<uint32_t> children;
+    std::vector<Color> colors;
+    std::vector<std::shared_ptr<const SDFTexture>> textures;
+    std::vector<std::shared_ptr<SDF>> custom;
+
+    double distance(uint32_t id, double x, double y) const {
+        const FlatNode& node = nodes[id];
+        if (isPrimitive(node.kind)) {
+            return primitiveDistance(node, x, y);
+        }
+        return compositeDistance(id, x, y);
+    }
+
+    /// distance() of many points, primitives go two points at a time with SSE2
+    void distances(uint32_t id, const double* xs, const double* ys, size_t count, double* out) const {
+        const FlatNode& node = nodes[id];
+        switch (node.kind) {
+            case NodeKind::Circle:
+                shapeDistances<CircleShape>(node, xs, ys, count, out);
+                break;
+            case NodeKind::AxisAlignedRectangle:
+                shapeDistances<RectShape>(node, xs, ys, count, out);
+                break;
+            case NodeKind::Segment:
+                shapeDistances<SegmentShape>(node, xs, ys, count, out);
+                break;
+            default:
+                for (size_t k = 0; k < count; ++k) {
+                    out[k] = distance(id, xs[k], ys[k]);
+                }
+        }
+    }
+
+    RGBColor getColor(uint32_t id, double x, double y) const {
+        return shadeSubtree<RGBColor>(id, x, y);
+    }
+
+    LinearColor getLinearColor(uint32_t id, double x, double y) const {
+        return shadeSubtree<LinearColor>(id, x, y);
+    }
+
+    Bounds bounds(uint32_t id) const {
+        return bounds(id, [this](uint32_t child) { return bounds(child); });
+    }
+
+    /// bounds() of every node in one backwards sweep, children come after their parents
+    std::vector<Bounds> allBounds() const {
+        std::vector<Bounds> result(nodes.size());
+        for (size_t id = nodes.size(); id-- > 0;) {
+            result[id] = bounds(uint32_t(id), [&result](uint32_t child) { return result[child]; });
+        }
+        return result;
+    }
+
+    /// Bounds of a node from the bounds of its children
+    template<typename ChildBounds>
+    Bounds bounds(uint32_t id, ChildBounds&& child_bounds) const {
+        const FlatNode& node = nodes[id];
+        const uint32_t* child = &children[node.first_child];
+        switch (node.kind) {
+            case NodeKind::Intersection:
+            case NodeKind::Overlay: {
+                Bounds result = Bounds::Empty();
+                for (uint32_t k = 0; k < node.child_count; ++k) {
+                    result = result.united(child_bounds(child[k]));
+                }
+                bool smooth = node.kind == NodeKind::Intersection && node.smooth;
+                return smooth ? result.padded(SmoothBlendPadding(node.params[0]) * (node.child_count - 1)) : result;
+            }
+            case NodeKind::Custom:
+                return custom[node.resource]->bounds();
+            default:
+                return PrimitiveBounds(node, node.kind == NodeKind::SDFImage ? textures[node.resource].get() : nullptr);
+        }
+    }
+
+    double edgeDistance(uint32_t id, double x, double y, double eps) const {
+        const FlatNode& node = nodes[id];
+        if (isPrimitive(node.kind)) {
+            return colors[node.color].edgeDistance(primitiveDistance(node, x, y), eps);
+        }
+        DistanceScratch values(node.subtree_end - id);
+        evaluate(id, x, y, values.data());
+        return subtreeEdgeDistance(id, x, y, {values.data(), id}, eps);
+    }
+private:
+    template<typename Shape>
+    static void shapeDistances(const FlatNode& node, const double* xs, const double* ys, size_t count, double* out) {
+        size_t k = 0;
+#if defined(__SSE2__)
+        __m128d p[Shape::kParams];
+        for (size_t m = 0; m < Shape::kParams; ++m) {
+            p[m] = _mm_set1_pd(node.params[m]);
+        }
+        for (; k + 2 <= count; k += 2) {
+            _mm_storeu_pd(out + k, Shape::distance(p, _mm_loadu_pd(xs + k), _mm_loadu_pd(ys + k)));
+        }
+#endif
+        for (; k < count; ++k) {
+            out[k] = Shape::distance(node.params, xs[k], ys[k]);
+        }
+    }
+
+    /// Distances of one subtree, on the stack unless the subtree is big
+    class DistanceScratch {
+        static constexpr size_t kStackSize = 128;
+        double stack_[kStackSize];
+        std::vector<double> heap_;
+        double* data_ = stack_;
+    public:
+        explicit DistanceScratch(size_t count) {
+            if (count > kStackSize) {
+                heap_.resize(count);
+                data_ = heap_.data();
+            }
+        }
+
+        double* data() {
+            return data_;
+        }
+    };
+
+    /// Distances of a subtree by node id
+    struct SubtreeDistances {
+        const double* values;
+        uint32_t root;
+
+        double operator[](uint32_t id) const {
+            return values[id - root];
+        }
+    };
+
+    static bool isPrimitive(NodeKind kind) {
+        return kind <= NodeKind::SDFImage;
+    }
+
+    double primitiveDistance(const FlatNode& node, double x, double y) const {
+        const double* p = node.params;
+        switch (node.kind) {
+            case NodeKind::Circle:
+                return CircleDistance(x, y, p[0], p[1], p[2]);
+            case NodeKind::AxisAlignedRectangle:
+                return AxisAlignedRectangleDistance(x, y, p[0], p[1], p[2], p[3]);
+            case NodeKind::Segment:
+                return SegmentDistance(x, y, p[0], p[1], p[2], p[3]);
+            case NodeKind::AxisAlignedEquilateralTriangle:
+                return AxisAlignedEquilateralTriangleDistance(x, y, p[0], p[1], p[3]);
+            default:
+                return textures[node.resource]->distance(x - p[3], y - p[4], p[2]);
+        }
+    }
+
+    double compositeDistance(uint32_t id, double x, double y) const {
+        DistanceScratch values(nodes[id].subtree_end - id);
+        evaluate(id, x, y, values.data());
+        return values.data()[0];
+    }
+
+    double combineIntersection(const FlatNode& node, SubtreeDistances values) const {
+        const uint32_t* child = &children[node.first_child];
+        double result = values[child[0]];
+        for (uint32_t k = 1; k < node.child_count; ++k) {
+            result = node.smooth ? sminCubic(result, values[child[k]], node.params[0]) : std::min(result, values[child[k]]);
+        }
+        return result;
+    }
+
+    /// Fills values[0, subtree size) with the distances of the nodes of id's subtree
+    void evaluate(uint32_t id, double x, double y, double* values) const {
+        SubtreeDistances value_of{values, id};
+        for (uint32_t i = nodes[id].subtree_end; i-- > id;) {
+            const FlatNode& node = nodes[i];
+            double& value = values[i - id];
+            switch (node.kind) {
+                case NodeKind::Intersection:
+                    value = combineIntersection(node, value_of);
+                    break;
+                case NodeKind::Overlay:
+                    value = std::min(value_of[children[node.first_child]], value_of[children[node.first_child + 1]]);
+                    break;
+                case NodeKind::Custom:
+                    value = custom[node.resource]->distance(x, y);
+                    break;
+                default:
+                    value = primitiveDistance(node, x, y);
+                    break;
+            }
+        }
+    }
+
+    double subtreeEdgeDistance(uint32_t id, double x, double y, SubtreeDistances value_of, double eps) const {
+        const FlatNode& node = nodes[id];
+        switch (node.kind) {
+            case NodeKind::Intersection: {
+                const uint32_t* child = &children[node.first_child];
+                double result = subtreeEdgeDistance(child[0], x, y, value_of, eps);
+                double combined = value_of[child[0]];
+                for (uint32_t k = 1; k < node.child_count; ++k) {
+                    result = std::min(result, subtreeEdgeDistance(child[k], x, y, value_of, eps));
+                    if (node.smooth) {
+                        // the blended surface has its own edge
+                        combined = sminCubic(combined, value_of[child[k]], node.params[0]);
+                        result = std::min(result, std::abs(combined - eps));
+                    }
+                }
+                return result;
+            }
+            case NodeKind::Overlay: {
+                const uint32_t* child = &children[node.first_child];
+                return std::min(subtreeEdgeDistance(child[0], x, y, value_of, eps), subtreeEdgeDistance(child[1], x, y, value_of, eps));
+            }
+            case NodeKind::Custom:
+                return custom[node.resource]->edgeDistance(x, y, eps);
+            default:
+                return colors[node.color].edgeDistance(value_of[id], eps);
+        }
+    }
+
+    /// The coordinate a primitive's gradient runs along
+    static double shadingArg(const FlatNode& node, double x, double y) {
+        const double* p = node.params;
+        switch (node.kind) {
+            case NodeKind::Circle:
+                return x - p[0] - p[2];
+            case NodeKind::AxisAlignedRectangle:
+                return y - p[1] - p[3];
+            case NodeKind::AxisAlignedEquilateralTriangle:
+                return y - p[1] - p[3];
+            case NodeKind::SDFImage:
+                return y - p[4] - p[2];
+            default:
+                return 0.0;
+        }
+    }
+
+    // MixColors spelled out, so it inlines into shade and the colors stay in registers
+    static RGBColor mix(const RGBColor& a, const RGBColor& b, double alpha) {
+        return {MixChannel(a.r, b.r, alpha), MixChannel(a.g, b.g, alpha), MixChannel(a.b, b.b, alpha)};
+    }
+
+    static LinearColor mix(const LinearColor& a, const LinearColor& b, double alpha) {
+        return MixLinear(a, b, alpha);
+    }
+
+    template<typename ColorType>
+    ColorType shadePrimitive(const FlatNode& node, double distance, double x, double y) const {
+        const Color& color = colors[node.color];
+        if constexpr (std::is_same_v<ColorType, LinearColor>) {
+            return color.getLinearColor(distance, shadingArg(node, x, y));
+        } else {
+            return color.getColor(distance, shadingArg(node, x, y));
+        }
+    }
+
+    template<typename ColorType>
+    ColorType shadeSubtree(uint32_t id, double x, double y) const {
+        const FlatNode& node = nodes[id];
+        if (isPrimitive(node.kind)) {
+            // a lone primitive only needs its distance for borders
+            return shadePrimitive<ColorType>(node, colors[node.color].usesDistance() ? primitiveDistance(node, x, y) : 0.0, x, y);
+        }
+        return shadeComposite<ColorType>(id, x, y);
+    }
+
+    template<typename ColorType>
+    ColorType shadeComposite(uint32_t id, double x, double y) const {
+        DistanceScratch values(nodes[id].subtree_end - id);
+        evaluate(id, x, y, values.data());
+        return shade<ColorType>(id, x, y, {values.data(), id});
+    }
+
+    template<typename ColorType>
+    ColorType shade(uint32_t id, double x, double y, SubtreeDistances value_of) const {
+        const FlatNode& node = nodes[id];
+        switch (node.kind) {
+            case NodeKind::Intersection: {
+                const uint32_t* child = &children[node.first_child];
+                double combined = value_of[child[0]];
+                if (!node.smooth) {
+                    uint32_t closest = child[0];
+                    for (uint32_t k = 1; k < node.child_count; ++k) {
+                        if (!(combined < value_of[child[k]])) {
+                            closest = child[k];
+                        }
+                        combined = std::min(combined, value_of[child[k]]);
+                    }
+                    return shade<ColorType>(closest, x, y, value_of);
+                }
+                ColorType color = shade<ColorType>(child[0], x, y, value_of);
+                for (uint32_t k = 1; k < node.child_count; ++k) {
+                    double blend = sminCubicCol(value_of[child[k]], combined, node.params[0]);
+                    color = mix(color, shade<ColorType>(child[k], x, y, value_of), blend);
+                    combined = sminCubic(combined, value_of[child[k]], node.params[0]);
+                }
+                return color;
+            }
+            case NodeKind::Overlay: {
+                uint32_t top = children[node.first_child], bottom = children[node.first_child + 1];
+                bool top_inside = value_of[top] < kOverlayEps;
+                bool bottom_inside = value_of[bottom] < kOverlayEps;
+                if (top_inside && bottom_inside) {
+                    return mix(shade<ColorType>(top, x, y, value_of), shade<ColorType>(bottom, x, y, value_of), node.params[0]);
+                } else if (bottom_inside) {
+                    return shade<ColorType>(bottom, x, y, value_of);
+                } else {
+                    return shade<ColorType>(top, x, y, value_of);
+                }
+            }
+            case NodeKind::Custom:
+                if constexpr (std::is_same_v<ColorType, LinearColor>) {
+                    return custom[node.resource]->getLinearColor(x, y);
+                } else {
+                    return custom[node.resource]->getColor(x, y);
+                }
+            default:
+                return shadePrimitive<ColorType>(node, value_of[id], x, y);
+        }
+    }
+};
+
+/// One object of a FlatScene behind the SDF interface, so Scene can render it.
+/// Only the call into the object is virtual, everything below it goes through FlatScene's switch
+class FlatObject final: public SDF {
+    std::shared_ptr<const FlatScene> scene_;
+    uint32_t root_;
+public:
+    FlatObject(std::shared_ptr<const FlatScene> scene, uint32_t root): scene_(std::move(scene)), root_(root) {}
+
+    double distance(double x, double y) override {
+        return scene_->distance(root_, x, y);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        return scene_->getColor(root_, x, y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        return scene_->getLinearColor(root_, x, y);
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        return scene_->edgeDistance(root_, x, y, eps);
+    }
+
+    void distances(const double* xs, const double* ys, size_t count, double* out) override {
+        scene_->distances(root_, xs, ys, count, out);
+    }
+
+    Bounds bounds() const override {
+        return scene_->bounds(root_);
+    }
+
+    const FlatScene& scene() const {
+        return *scene_;
+    }
+
+    uint32_t root() const {
+        return root_;
+    }
+};
+
+#endif //SDF_FLAT_SCENE_H
@@ -1,10 +1,24 @@
 #ifndef SDF_IMAGE_H
 #define SDF_IMAGE_H
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
 #include <vector>
 #include <string>
 
+#include "buffer_pool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "include/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -37,4 +51,401 @@ public:
 void Save8bitRgbImage(const std::string& path, const Image<uint8_t>& image) {
     stbi_write_png(path.c_str(), image.width_, image.height_, STBI_rgb, image.pixel_data_.data(), image.width_ * image.channels_);
 }
+
+constexpr size_t kImageAlignment = 64; // cache line and widest vector register
+
+struct AlignedDeleter {
+    enum class Source {
+        Heap,     // aligned operator new
+        Borrowed, // memory owned by someone else, e.g. a shared framebuffer
+        Pool,     // goes back to the BufferPool
+    };
+    Source source = Source::Heap;
+    BufferPool* pool = nullptr;
+    size_t bytes = 0;
+
+    void operator()(void* ptr) const {
+        switch (source) {
+            case Source::Heap:
+                ::operator delete(ptr, std::align_val_t(kImageAlignment));
+                break;
+            case Source::Pool:
+                pool->Release(ptr, bytes);
+                break;
+            case Source::Borrowed:
+                break;
+        }
+    }
+};
+
+/// Image with the channel count known at compile time.
+/// Storage starts on a 64 byte boundary and every row is padded to a multiple of 64 bytes,
+/// so each row can be written with aligned vector stores.
+template <typename pixel_type, size_t channels>
+class AlignedImage {
+public:
+    static constexpr size_t channels_ = channels;
+    const size_t height_, width_;
+    const size_t pitch_; // distance between rows in elements
+private:
+    std::unique_ptr<pixel_type, AlignedDeleter> pixel_data_;
+
+    static size_t RowPitch(size_t width) {
+        size_t row_bytes = width * channels * sizeof(pixel_type);
+        row_bytes = (row_bytes + kImageAlignment - 1) / kImageAlignment * kImageAlignment;
+        return row_bytes / sizeof(pixel_type);
+    }
+public:
+    static_assert(kImageAlignment % sizeof(pixel_type) == 0, "pixel type must divide the alignment");
+
+    AlignedImage(size_t height, size_t width):
+            height_(height),
+            width_(width),
+            pitch_(RowPitch(width)),
+            pixel_data_(static_cast<pixel_type*>(::operator new(height_ * pitch_ * sizeof(pixel_type),
+                                                                std::align_val_t(kImageAlignment)))) {
+        std::memset(pixel_data_.get(), 0, height_ * pitch_ * sizeof(pixel_type));
+    }
+
+    /// Wraps memory owned by someone else. It must be aligned to kImageAlignment
+    /// and hold at least RequiredBytes(height, width) bytes
+    AlignedImage(size_t height, size_t width, pixel_type* external):
+            height_(height),
+            width_(width),
+            pitch_(RowPitch(width)),
+            pixel_data_(external, AlignedDeleter{AlignedDeleter::Source::Borrowed}) {}
+
+    /// Takes recycled storage from the pool and gives it back on destruction.
+    /// Unlike the other constructors this does not clear the pixels
+    AlignedImage(size_t height, size_t width, BufferPool& pool):
+            height_(height),
+            width_(width),
+            pitch_(RowPitch(width)),
+            pixel_data_(static_cast<pixel_type*>(pool.Acquire(RequiredBytes(height, width))),
+                        AlignedDeleter{AlignedDeleter::Source::Pool, &pool, RequiredBytes(height, width)}) {}
+
+    static size_t RequiredBytes(size_t height, size_t width) {
+        return height * RowPitch(width) * sizeof(pixel_type);
+    }
+
+    pixel_type& operator()(size_t x, size_t y, size_t z) {
+        return pixel_data_.get()[x * pitch_ + y * channels + z];
+    }
+
+    /// First element of row x, always aligned to kImageAlignment
+    pixel_type* row(size_t x) {
+        return pixel_data_.get() + x * pitch_;
+    }
+    const pixel_type* row(size_t x) const {
+        return pixel_data_.get() + x * pitch_;
+    }
+
+    pixel_type* data() { return pixel_data_.get(); }
+    const pixel_type* data() const { return pixel_data_.get(); }
+};
+
+void Save8bitRgbImage(const std::string& path, const AlignedImage<uint8_t, 3>& image) {
+    stbi_write_png(path.c_str(), image.width_, image.height_, STBI_rgb, image.data(), image.pitch_);
+}
+
+void Save8bitRgbImage(const std::string& path, const AlignedImage<uint8_t, 4>& image) {
+    stbi_write_png(path.c_str(), image.width_, image.height_, STBI_rgb_alpha, image.data(), image.pitch_);
+}
+
+// Quantization of linear float images, the only place the float pipeline rounds.
+// Values are encoded with gamma 2 like the rest of the color code and rounded to nearest.
+
+void QuantizeLinearTo8bit(const float* linear, uint8_t* out, size_t count) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    const __m128 scale = _mm_set1_ps(255.f), half = _mm_set1_ps(0.5f);
+    auto quantize = [&](const float* in) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in), zero), one);
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(v), scale), half));
+    };
+    for (; i + 16 <= count; i += 16) {
+        __m128i low = _mm_packs_epi32(quantize(linear + i), quantize(linear + i + 4));
+        __m128i high = _mm_packs_epi32(quantize(linear + i + 8), quantize(linear + i + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = uint8_t(std::sqrt(std::clamp(linear[i], 0.f, 1.f)) * 255.f + 0.5f);
+    }
+}
+
+void QuantizeLinearTo16bit(const float* linear, uint16_t* out, size_t count) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    const __m128 scale = _mm_set1_ps(65535.f), half = _mm_set1_ps(0.5f);
+    // SSE2 only packs with signed saturation, so pack around zero and flip the sign bit back
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i sign = _mm_set1_epi16(int16_t(0x8000));
+    auto quantize = [&](const float* in) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in), zero), one);
+        __m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(v), scale), half));
+        return _mm_sub_epi32(q, bias);
+    };
+    for (; i + 8 <= count; i += 8) {
+        __m128i packed = _mm_packs_epi32(quantize(linear + i), quantize(linear + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(packed, sign));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = uint16_t(std::sqrt(std::clamp(linear[i], 0.f, 1.f)) * 65535.f + 0.5f);
+    }
+}
+
+void Save8bitRgbImage(const std::string& path, const AlignedImage<float, 3>& image) {
+    AlignedImage<uint8_t, 3> quantized(image.height_, image.width_);
+    for (size_t i = 0; i < image.height_; ++i) {
+        QuantizeLinearTo8bit(image.row(i), quantized.row(i), image.width_ * 3);
+    }
+    Save8bitRgbImage(path, quantized);
+}
+
+uint32_t PngCrc32(const uint8_t* data, size_t size, uint32_t crc=0) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> result{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            result[n] = c;
+        }
+        return result;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/// 16 bit per channel RGB PNG, stb_image_write only does 8 bit so the container is written here
+/// and only the deflate step is borrowed from stb
+void Save16bitRgbImage(const std::string& path, const AlignedImage<float, 3>& image) {
+    size_t row_bytes = image.width_ * 3 * 2;
+    std::vector<uint8_t> filtered(image.height_ * (row_bytes + 1));
+    std::vector<uint16_t> samples(image.width_ * 3);
+    std::vector<uint8_t> previous(row_bytes, 0), current(row_bytes);
+    for (size_t i = 0; i < image.height_; ++i) {
+        QuantizeLinearTo16bit(image.row(i), samples.data(), samples.size());
+        for (size_t k = 0; k < samples.size(); ++k) {
+            current[2 * k] = uint8_t(samples[k] >> 8); // PNG is big endian
+            current[2 * k + 1] = uint8_t(samples[k]);
+        }
+        // "Up" filter, neighbouring rows of a render are usually very similar
+        uint8_t* out = &filtered[i * (row_bytes + 1)];
+        out[0] = 2;
+        for (size_t k = 0; k < row_bytes; ++k) {
+            out[k + 1] = uint8_t(current[k] - previous[k]);
+        }
+        std::swap(previous, current);
+    }
+
+    int compressed_size = 0;
+    uint8_t* compressed = stbi_zlib_compress(filtered.data(), int(filtered.size()), &compressed_size, 8);
+    if (compressed == nullptr) {
+        std::cerr << "Failed to compress " << path << std::endl;
+        return;
+    }
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        STBIW_FREE(compressed);
+        return;
+    }
+    auto put32 = [](uint8_t* out, uint32_t value) {
+        out[0] = uint8_t(value >> 24);
+        out[1] = uint8_t(value >> 16);
+        out[2] = uint8_t(value >> 8);
+        out[3] = uint8_t(value);
+    };
+    auto write_chunk = [&](const char* type, const uint8_t* data, size_t size) {
+        uint8_t header[8];
+        put32(header, uint32_t(size));
+        std::memcpy(header + 4, type, 4);
+        uint8_t crc[4];
+        put32(crc, PngCrc32(data, size, PngCrc32(header + 4, 4)));
+        std::fwrite(header, 1, 8, file);
+        if (size > 0) {
+            std::fwrite(data, 1, size, file);
+        }
+        std::fwrite(crc, 1, 4, file);
+    };
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    std::fwrite(signature, 1, 8, file);
+    uint8_t ihdr[13];
+    put32(ihdr, uint32_t(image.width_));
+    put32(ihdr + 4, uint32_t(image.height_));
+    ihdr[8] = 16; // bit depth
+    ihdr[9] = 2;  // truecolor
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    write_chunk("IHDR", ihdr, sizeof(ihdr));
+    write_chunk("IDAT", compressed, compressed_size);
+    write_chunk("IEND", nullptr, 0);
+    std::fclose(file);
+    STBIW_FREE(compressed);
+}
+
+/// Adler-32 of data continued from adler, the checksum that ends a zlib stream
+uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler=1) {
+    const uint32_t kBase = 65521;
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+        size_t block = std::min<size_t>(size, 5552); // longest run before b can overflow
+        for (size_t i = 0; i < block; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= kBase;
+        b %= kBase;
+        data += block;
+        size -= block;
+    }
+    return a | b << 16;
+}
+
+/// Adler-32 of two pieces joined, from the checksums of the pieces and the length of the second one
+uint32_t Adler32Combine(uint32_t first, uint32_t second, size_t second_size) {
+    const uint32_t kBase = 65521;
+    auto remainder = uint32_t(second_size % kBase);
+    uint32_t a = first & 0xffff;
+    uint32_t b = uint32_t(uint64_t(remainder) * a % kBase);
+    a += (second & 0xffff) + kBase - 1;
+    b += (first >> 16) + (second >> 16) + kBase - remainder;
+    a %= kBase;
+    b %= kBase;
+    return a | b << 16;
+}
+
+/// 8 bit RGB PNG kept as one IDAT chunk per band of rows. Every band is a run of stored (uncompressed)
+/// deflate blocks over unfiltered rows, so bands don't depend on each other: after a change only the
+/// bands that changed are encoded again and the file is written out of the kept chunks.
+/// The price is a file as large as the raw pixels. Every row has to go through update() once before save()
+class BandedPngWriter {
+    struct Band {
+        std::vector<uint8_t> chunk; // the whole IDAT chunk
+        uint32_t adler = 1;         // of the band's deflated bytes
+        size_t size = 0;            // deflated bytes, a filter byte and the pixels of every row
+    };
+
+    size_t height_, width_, band_rows_;
+    std::vector<Band> bands_;
+
+    static void Put32(uint8_t* out, uint32_t value) {
+        out[0] = uint8_t(value >> 24);
+        out[1] = uint8_t(value >> 16);
+        out[2] = uint8_t(value >> 8);
+        out[3] = uint8_t(value);
+    }
+
+    /// Length, type, data and CRC of a chunk
+    static std::vector<uint8_t> Chunk(const char* type, const uint8_t* data, size_t size) {
+        std::vector<uint8_t> chunk(8);
+        chunk.reserve(size + 12);
+        Put32(chunk.data(), uint32_t(size));
+        std::memcpy(chunk.data() + 4, type, 4);
+        chunk.insert(chunk.end(), data, data + size);
+        chunk.resize(size + 12);
+        Put32(chunk.data() + 8 + size, PngCrc32(chunk.data() + 4, size + 4));
+        return chunk;
+    }
+
+    void encode(const AlignedImage<uint8_t, 3>& image, size_t band) {
+        const size_t kMaxStoredBlock = 65535;
+        size_t row_begin = band * band_rows_, row_end = std::min(height_, row_begin + band_rows_);
+        size_t row_bytes = width_ * 3 + 1;
+        size_t size = (row_end - row_begin) * row_bytes;
+        std::vector<uint8_t> raw(size);
+        for (size_t i = row_begin; i < row_end; ++i) {
+            uint8_t* out = &raw[(i - row_begin) * row_bytes];
+            out[0] = 0; // no filter, the first row of a band can't look at the band above
+            std::memcpy(out + 1, image.row(i), width_ * 3);
+        }
+
+        std::vector<uint8_t> deflated;
+        deflated.reserve(size + (size / kMaxStoredBlock + 1) * 5);
+        for (size_t begin = 0; begin < size; begin += kMaxStoredBlock) {
+            auto length = uint16_t(std::min(kMaxStoredBlock, size - begin));
+            // not the final block, stored, then length and its complement in little endian
+            const uint8_t header[5] = {0, uint8_t(length), uint8_t(length >> 8),
+                                       uint8_t(~length), uint8_t(uint16_t(~length) >> 8)};
+            deflated.insert(deflated.end(), header, header + 5);
+            deflated.insert(deflated.end(), raw.begin() + begin, raw.begin() + begin + length);
+        }
+        bands_[band].chunk = Chunk("IDAT", deflated.data(), deflated.size());
+        bands_[band].adler = Adler32(raw.data(), raw.size());
+        bands_[band].size = size;
+    }
+public:
+    BandedPngWriter(size_t height, size_t width, size_t band_rows):
+        height_(height), width_(width), band_rows_(band_rows), bands_((height + band_rows - 1) / band_rows) {}
+
+    /// Encodes again the bands holding any of the rows [row_begin, row_end) of image
+    void update(const AlignedImage<uint8_t, 3>& image, size_t row_begin, size_t row_end) {
+        for (size_t band = row_begin / band_rows_; band * band_rows_ < std::min(row_end, height_); ++band) {
+            encode(image, band);
+        }
+    }
+
+    bool save(const std::string& path) const {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << path << " for writing" << std::endl;
+            return false;
+        }
+        auto write = [&](const std::vector<uint8_t>& bytes) {
+            std::fwrite(bytes.data(), 1, bytes.size(), file);
+        };
+        const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        std::fwrite(signature, 1, 8, file);
+        uint8_t ihdr[13];
+        Put32(ihdr, uint32_t(width_));
+        Put32(ihdr + 4, uint32_t(height_));
+        ihdr[8] = 8; // bit depth
+        ihdr[9] = 2; // truecolor
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        write(Chunk("IHDR", ihdr, sizeof(ihdr)));
+
+        // the zlib stream runs through all IDAT chunks: its header, the bands, an empty final block and the checksum
+        const uint8_t zlib_header[2] = {0x78, 0x01};
+        write(Chunk("IDAT", zlib_header, sizeof(zlib_header)));
+        uint32_t adler = 1;
+        for (const Band& band : bands_) {
+            write(band.chunk);
+            adler = Adler32Combine(adler, band.adler, band.size);
+        }
+        uint8_t end[9] = {1, 0, 0, 0xff, 0xff};
+        Put32(end + 5, adler);
+        write(Chunk("IDAT", end, sizeof(end)));
+        write(Chunk("IEND", nullptr, 0));
+        bool written = !std::ferror(file);
+        if (std::fclose(file) != 0 || !written) {
+            std::cerr << "Failed to write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+/// Raw linear float32 RGB as little endian PFM, readable by most compositing tools.
+/// PFM stores rows bottom to top
+void SaveFloatRgbImage(const std::string& path, const AlignedImage<float, 3>& image) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return;
+    }
+    std::fprintf(file, "PF\n%zu %zu\n-1.0\n", image.width_, image.height_);
+    for (size_t i = image.height_; i-- > 0;) {
+        std::fwrite(image.row(i), sizeof(float), image.width_ * 3, file);
+    }
+    std::fclose(file);
+}
 #endif //SDF_IMAGE_H
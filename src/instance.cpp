@@ -0,0 +1 @@
+#include "instance.h"
@@ -0,0 +1,222 @@
+#ifndef SDF_INSTANCE_H
+#define SDF_INSTANCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "distance_functions.h"
+#include "transform.h"
+#include "uniform_grid.h"
+
+/// Where a copy of a shape goes: scaled about the shape's origin, rotated counterclockwise by angle
+/// radians, then moved to (x, y). If color is set, it replaces all colors of the shape
+struct InstancePlacement {
+    double x = 0.0, y = 0.0;
+    double scale = 1.0;
+    double angle = 0.0;
+    std::optional<RGBColor> color;
+};
+
+/// An InstancePlacement ready for queries, the rotation and the inverse scale are computed once.
+/// Rotation and translation keep distances, scale multiplies them
+class InstanceFrame {
+    double x_, y_;
+    double cos_, sin_;
+    double scale_, inverse_scale_;
+public:
+    explicit InstanceFrame(const InstancePlacement& placement):
+        x_(placement.x),
+        y_(placement.y),
+        cos_(std::cos(placement.angle)),
+        sin_(std::sin(placement.angle)),
+        scale_(placement.scale),
+        inverse_scale_(1.0 / placement.scale)
+    {
+        if (!(placement.scale > 0)) {
+            std::cerr << "Instance scale must be positive" << std::endl;
+            exit(1);
+        }
+    }
+
+    double scale() const {
+        return scale_;
+    }
+
+    /// (x, y) in the shape's own coordinates
+    void toLocal(double x, double y, double& local_x, double& local_y) const {
+        double dx = x - x_, dy = y - y_;
+        local_x = (cos_ * dx + sin_ * dy) * inverse_scale_;
+        local_y = (cos_ * dy - sin_ * dx) * inverse_scale_;
+    }
+
+    /// Box around the shape's box once placed
+    Bounds place(const Bounds& box) const {
+        return TransformedBounds(box, {scale_ * cos_, -scale_ * sin_, x_, scale_ * sin_, scale_ * cos_, y_});
+    }
+};
+
+/// One placed copy of a shared shape. The shape is not copied, so many instances of one SDFImage
+/// share its texture; the only per instance work is moving the query point into the shape's frame
+class Instance final: public SDF {
+    std::shared_ptr<SDF> child_;
+    InstanceFrame frame_;
+    std::optional<RGBColor> color_;
+public:
+    Instance(std::shared_ptr<SDF> child, const InstancePlacement& placement):
+        child_(std::move(child)), frame_(placement), color_(placement.color) {}
+
+    double distance(double x, double y) override {
+        double local_x, local_y;
+        frame_.toLocal(x, y, local_x, local_y);
+        return frame_.scale() * child_->distance(local_x, local_y);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        if (color_) {
+            return *color_;
+        }
+        double local_x, local_y;
+        frame_.toLocal(x, y, local_x, local_y);
+        return child_->getColor(local_x, local_y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        if (color_) {
+            return ToLinear(*color_);
+        }
+        double local_x, local_y;
+        frame_.toLocal(x, y, local_x, local_y);
+        return child_->getLinearColor(local_x, local_y);
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        if (color_) {
+            // one flat color, the outline is the only edge left
+            return std::abs(distance(x, y) - eps);
+        }
+        double local_x, local_y;
+        frame_.toLocal(x, y, local_x, local_y);
+        return frame_.scale() * child_->edgeDistance(local_x, local_y, eps / frame_.scale());
+    }
+
+    Bounds bounds() const override {
+        return frame_.place(child_->bounds());
+    }
+};
+
+/// Many placed copies of one shared shape as a single node, the union of all of them like PrimitiveSet:
+/// the closest instance wins, ties going to the later one. The instances are binned by their bounds into
+/// a uniform grid, so a pixel costs as much as the instances around it, however many there are elsewhere.
+/// The shape needs finite bounds
+class InstanceSet final: public SDF {
+    static constexpr size_t kInstancesPerCell = 4;
+
+    std::shared_ptr<SDF> child_;
+    std::vector<InstanceFrame> frames_;
+    std::vector<std::optional<RGBColor>> colors_;
+    UniformGrid grid_;
+
+    double instanceDistance(uint32_t instance, double x, double y) const {
+        double local_x, local_y;
+        frames_[instance].toLocal(x, y, local_x, local_y);
+        return frames_[instance].scale() * child_->distance(local_x, local_y);
+    }
+
+    double nearest(double x, double y, uint32_t& best_index) const {
+        const std::vector<uint32_t>& items = grid_.items();
+        double best = std::numeric_limits<double>::infinity();
+        best_index = 0;
+        grid_.search(x, y, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                double distance = instanceDistance(items[k], x, y);
+                if (distance < best || (distance == best && items[k] > best_index)) {
+                    best = distance;
+                    best_index = items[k];
+                }
+            }
+        }, [&](double bound) {
+            return best < bound;
+        });
+        return best;
+    }
+public:
+    InstanceSet(std::shared_ptr<SDF> child, const std::vector<InstancePlacement>& placements): child_(std::move(child)) {
+        if (placements.empty()) {
+            std::cerr << "Instance set needs at least one instance" << std::endl;
+            exit(1);
+        }
+        Bounds child_bounds = child_->bounds();
+        std::vector<Bounds> boxes;
+        for (const InstancePlacement& placement : placements) {
+            frames_.emplace_back(placement);
+            colors_.push_back(placement.color);
+            boxes.push_back(frames_.back().place(child_bounds));
+        }
+        grid_ = UniformGrid(std::move(boxes), kInstancesPerCell);
+    }
+
+    size_t size() const {
+        return frames_.size();
+    }
+
+    double distance(double x, double y) override {
+        uint32_t instance;
+        return nearest(x, y, instance);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        uint32_t instance;
+        nearest(x, y, instance);
+        if (colors_[instance]) {
+            return *colors_[instance];
+        }
+        double local_x, local_y;
+        frames_[instance].toLocal(x, y, local_x, local_y);
+        return child_->getColor(local_x, local_y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        uint32_t instance;
+        nearest(x, y, instance);
+        if (colors_[instance]) {
+            return ToLinear(*colors_[instance]);
+        }
+        double local_x, local_y;
+        frames_[instance].toLocal(x, y, local_x, local_y);
+        return child_->getLinearColor(local_x, local_y);
+    }
+
+    /// Edges of the instances around the point. Instances farther than the closest edge found
+    /// only count with their outline: a border outside a shape is never drawn
+    double edgeDistance(double x, double y, double eps) override {
+        const std::vector<uint32_t>& items = grid_.items();
+        double best = std::numeric_limits<double>::infinity();
+        grid_.search(x, y, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const InstanceFrame& frame = frames_[items[k]];
+                double local_x, local_y;
+                frame.toLocal(x, y, local_x, local_y);
+                double edge = colors_[items[k]]
+                    ? std::abs(frame.scale() * child_->distance(local_x, local_y) - eps)
+                    : frame.scale() * child_->edgeDistance(local_x, local_y, eps / frame.scale());
+                best = std::min(best, edge);
+            }
+        }, [&](double bound) {
+            return best < bound - eps;
+        });
+        return best;
+    }
+
+    Bounds bounds() const override {
+        return grid_.bounds();
+    }
+};
+
+#endif //SDF_INSTANCE_H
@@ -0,0 +1,36 @@
+#ifndef SDF_PARALLEL_H
+#define SDF_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+size_t WorkerCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// Calls body(begin, end) on consecutive chunks of [0, count), one chunk per worker thread.
+/// Chunks never get smaller than min_chunk, small ranges stay on the calling thread
+template<typename Body>
+void ParallelFor(size_t count, Body&& body, size_t min_chunk=1) {
+    size_t workers = std::min(WorkerCount(), (count + min_chunk - 1) / std::max<size_t>(min_chunk, 1));
+    if (workers <= 1) {
+        if (count > 0) {
+            body(size_t(0), count);
+        }
+        return;
+    }
+    size_t chunk = (count + workers - 1) / workers;
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        threads.emplace_back([&body, begin, end = std::min(count, begin + chunk)] { body(begin, end); });
+    }
+    body(size_t(0), std::min(count, chunk));
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+#endif //SDF_PARALLEL_H
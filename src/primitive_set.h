@@ -0,0 +1,179 @@
+#ifndef SDF_PRIMITIVE_SET_H
+#define SDF_PRIMITIVE_SET_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "distance_functions.h"
+#include "primitive_shapes.h"
+#include "uniform_grid.h"
+
+/// Many primitives of one shape as a single node, the union of all of them: the distance is the smallest
+/// one and the color is the closest element's, ties going to the later element, exactly like a chain of
+/// Intersections. Parameters live in structure-of-arrays runs, one run per cell of a uniform grid over
+/// the set, and a pixel only looks at the cells around it until no farther cell can hold anything closer
+template <typename Shape>
+class PrimitiveSet final: public SDF {
+public:
+    struct Element {
+        std::array<double, Shape::kParams> params;
+        Color color;
+    };
+private:
+    static constexpr size_t kElementsPerCell = 8;
+
+    UniformGrid grid_;
+    std::array<std::vector<double>, Shape::kParams> params_; // the grid's runs, one array per parameter
+    std::vector<Color> colors_;
+    std::vector<double> element_params_;                     // kParams per element, for shading
+    double max_border_ = 0.0;
+
+    const double* elementParams(uint32_t element) const {
+        return &element_params_[size_t(element) * Shape::kParams];
+    }
+
+    void buildGrid() {
+        std::vector<Bounds> boxes(colors_.size());
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            boxes[i] = Shape::bounds(elementParams(uint32_t(i)));
+        }
+        grid_ = UniformGrid(std::move(boxes), kElementsPerCell);
+        const std::vector<uint32_t>& items = grid_.items();
+        for (size_t m = 0; m < Shape::kParams; ++m) {
+            params_[m].resize(items.size());
+            for (size_t k = 0; k < items.size(); ++k) {
+                params_[m][k] = elementParams(items[k])[m];
+            }
+        }
+    }
+
+    /// Smallest distance over the run [begin, end), ties go to the higher element index
+    template <bool kWithIndex>
+    void nearestInRun(size_t begin, size_t end, double x, double y, double& best, uint32_t& best_index) const {
+        const std::vector<uint32_t>& items = grid_.items();
+        size_t k = begin;
+#if defined(__SSE2__)
+        if (end - begin >= 2) {
+            __m128d px = _mm_set1_pd(x), py = _mm_set1_pd(y);
+            __m128d lane_best = _mm_set1_pd(best), lane_index = _mm_set1_pd(double(best_index));
+            for (; k + 2 <= end; k += 2) {
+                __m128d p[Shape::kParams];
+                for (size_t m = 0; m < Shape::kParams; ++m) {
+                    p[m] = _mm_loadu_pd(&params_[m][k]);
+                }
+                __m128d distance = Shape::distance(p, px, py);
+                if constexpr (kWithIndex) {
+                    __m128d index = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&items[k])));
+                    __m128d closer = _mm_or_pd(_mm_cmplt_pd(distance, lane_best),
+                                               _mm_and_pd(_mm_cmpeq_pd(distance, lane_best), _mm_cmpgt_pd(index, lane_index)));
+                    lane_best = _mm_or_pd(_mm_and_pd(closer, distance), _mm_andnot_pd(closer, lane_best));
+                    lane_index = _mm_or_pd(_mm_and_pd(closer, index), _mm_andnot_pd(closer, lane_index));
+                } else {
+                    lane_best = _mm_min_pd(distance, lane_best);
+                }
+            }
+            double values[2], indices[2];
+            _mm_storeu_pd(values, lane_best);
+            _mm_storeu_pd(indices, lane_index);
+            for (int lane = 0; lane < 2; ++lane) {
+                auto index = uint32_t(indices[lane]);
+                if (values[lane] < best || (kWithIndex && values[lane] == best && index > best_index)) {
+                    best = values[lane];
+                    best_index = index;
+                }
+            }
+        }
+#endif
+        for (; k < end; ++k) {
+            double p[Shape::kParams];
+            for (size_t m = 0; m < Shape::kParams; ++m) {
+                p[m] = params_[m][k];
+            }
+            double distance = Shape::distance(p, x, y);
+            if (distance < best || (kWithIndex && distance == best && items[k] > best_index)) {
+                best = distance;
+                best_index = items[k];
+            }
+        }
+    }
+
+    template <bool kWithIndex>
+    double nearest(double x, double y, uint32_t& best_index) const {
+        double best = std::numeric_limits<double>::infinity();
+        best_index = 0;
+        grid_.search(x, y, [&](size_t begin, size_t end) {
+            nearestInRun<kWithIndex>(begin, end, x, y, best, best_index);
+        }, [&](double bound) {
+            return best < bound;
+        });
+        return best;
+    }
+public:
+    explicit PrimitiveSet(const std::vector<Element>& elements) {
+        if (elements.empty()) {
+            std::cerr << "Primitive set needs at least one element" << std::endl;
+            exit(1);
+        }
+        for (const Element& element : elements) {
+            element_params_.insert(element_params_.end(), element.params.begin(), element.params.end());
+            colors_.push_back(element.color);
+            max_border_ = std::max(max_border_, element.color.borderThickness());
+        }
+        buildGrid();
+    }
+
+    size_t size() const {
+        return colors_.size();
+    }
+
+    double distance(double x, double y) override {
+        uint32_t index;
+        return nearest<false>(x, y, index);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        uint32_t index;
+        double distance = nearest<true>(x, y, index);
+        return colors_[index].getColor(distance, Shape::shadingArg(elementParams(index), x, y));
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        uint32_t index;
+        double distance = nearest<true>(x, y, index);
+        return colors_[index].getLinearColor(distance, Shape::shadingArg(elementParams(index), x, y));
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        // an element at distance d has its edges at eps and its border, no closer than d - max(eps, border)
+        double best = std::numeric_limits<double>::infinity();
+        const std::vector<uint32_t>& items = grid_.items();
+        grid_.search(x, y, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                const double* p = elementParams(items[k]);
+                best = std::min(best, colors_[items[k]].edgeDistance(Shape::distance(p, x, y), eps));
+            }
+        }, [&](double bound) {
+            return best < bound - std::max(eps, max_border_);
+        });
+        return best;
+    }
+
+    Bounds bounds() const override {
+        return grid_.bounds();
+    }
+};
+
+using CircleSet = PrimitiveSet<CircleShape>;
+using RectSet = PrimitiveSet<RectShape>;
+using SegmentSet = PrimitiveSet<SegmentShape>;
+
+#endif //SDF_PRIMITIVE_SET_H
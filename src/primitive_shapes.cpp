@@ -0,0 +1 @@
+#include "primitive_shapes.h"
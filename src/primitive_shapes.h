@@ -0,0 +1,94 @@
+#ifndef SDF_PRIMITIVE_SHAPES_H
+#define SDF_PRIMITIVE_SHAPES_H
+
+#include <cstddef>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "distance_functions.h"
+
+// Shapes of a PrimitiveSet and of batched FlatScene queries: kParams numbers per element, and the element's distance both for
+// one element and, with SSE2, for two at once. Both compute exactly what the matching SDF class does
+
+struct CircleShape {
+    static constexpr size_t kParams = 3; // x, y, radius
+
+    static double distance(const double* p, double x, double y) {
+        return CircleDistance(x, y, p[0], p[1], p[2]);
+    }
+
+#if defined(__SSE2__)
+    static __m128d distance(const __m128d* p, __m128d x, __m128d y) {
+        __m128d dx = _mm_sub_pd(x, p[0]), dy = _mm_sub_pd(y, p[1]);
+        return _mm_sub_pd(_mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy))), p[2]);
+    }
+#endif
+
+    static double shadingArg(const double* p, double x, double) {
+        return x - p[0] - p[2];
+    }
+
+    static Bounds bounds(const double* p) {
+        return CircleBounds(p[0], p[1], p[2]);
+    }
+};
+
+struct RectShape {
+    static constexpr size_t kParams = 4; // x, y, width, height
+
+    static double distance(const double* p, double x, double y) {
+        return AxisAlignedRectangleDistance(x, y, p[0], p[1], p[2], p[3]);
+    }
+
+#if defined(__SSE2__)
+    static __m128d distance(const __m128d* p, __m128d x, __m128d y) {
+        const __m128d zero = _mm_setzero_pd(), sign = _mm_set1_pd(-0.0);
+        __m128d dx = _mm_sub_pd(_mm_andnot_pd(sign, _mm_sub_pd(x, p[0])), p[2]);
+        __m128d dy = _mm_sub_pd(_mm_andnot_pd(sign, _mm_sub_pd(y, p[1])), p[3]);
+        __m128d outside_x = _mm_max_pd(zero, dx), outside_y = _mm_max_pd(zero, dy);
+        __m128d outside = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(outside_x, outside_x), _mm_mul_pd(outside_y, outside_y)));
+        return _mm_add_pd(outside, _mm_min_pd(zero, _mm_max_pd(dy, dx)));
+    }
+#endif
+
+    static double shadingArg(const double* p, double, double y) {
+        return y - p[1] - p[3];
+    }
+
+    static Bounds bounds(const double* p) {
+        return AxisAlignedRectangleBounds(p[0], p[1], p[2], p[3]);
+    }
+};
+
+struct SegmentShape {
+    static constexpr size_t kParams = 4; // a_x, a_y, b_x, b_y
+
+    static double distance(const double* p, double x, double y) {
+        return SegmentDistance(x, y, p[0], p[1], p[2], p[3]);
+    }
+
+#if defined(__SSE2__)
+    static __m128d distance(const __m128d* p, __m128d x, __m128d y) {
+        __m128d dx = _mm_sub_pd(x, p[0]), dy = _mm_sub_pd(y, p[1]);
+        __m128d bax = _mm_sub_pd(p[2], p[0]), bay = _mm_sub_pd(p[3], p[1]);
+        __m128d h = _mm_div_pd(_mm_add_pd(_mm_mul_pd(dx, bax), _mm_mul_pd(dy, bay)),
+                               _mm_add_pd(_mm_mul_pd(bax, bax), _mm_mul_pd(bay, bay)));
+        // operands in the order that keeps a NaN from a zero length segment, like std::clamp
+        h = _mm_min_pd(_mm_set1_pd(1.0), _mm_max_pd(_mm_setzero_pd(), h));
+        __m128d ex = _mm_sub_pd(dx, _mm_mul_pd(bax, h)), ey = _mm_sub_pd(dy, _mm_mul_pd(bay, h));
+        return _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey)));
+    }
+#endif
+
+    static double shadingArg(const double*, double, double) {
+        return 0.0;
+    }
+
+    static Bounds bounds(const double* p) {
+        return SegmentBounds(p[0], p[1], p[2], p[3]);
+    }
+};
+
+#endif //SDF_PRIMITIVE_SHAPES_H
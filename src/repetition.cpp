@@ -0,0 +1 @@
+#include "repetition.h"
@@ -0,0 +1,191 @@
+#ifndef SDF_REPETITION_H
+#define SDF_REPETITION_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "distance_functions.h"
+
+// Repetition nodes fold the query point into one cell and evaluate their child once, so a pattern
+// costs one child evaluation per pixel however many copies are visible. The child has to fit in its
+// cell: copies are cut at the cell borders, and outside the shapes the distance is the one to the
+// copy of the point's own cell, which near a cell border can exceed the distance to a neighbour
+
+/// Count of copies that repeats forever along an axis
+constexpr int kEndless = -1;
+
+/// Index of the copy closest to t for copies at multiples of period, limited to [-count, count]
+double RepetitionCell(double t, double period, int count) {
+    if (count == 0) {
+        return 0.0;
+    }
+    double cell = std::round(t / period);
+    return count == kEndless ? cell : std::clamp(cell, double(-count), double(count));
+}
+
+/// Range covered by copies of [min, max] moved by multiples of period in [-count, count]
+std::pair<double, double> RepeatedRange(double min, double max, double period, int count) {
+    if (count == kEndless) {
+        return {-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+    }
+    return {min - count * period, max + count * period};
+}
+
+/// Copies of the child moved by (i * period_x, j * period_y) for i in [-count_x, count_x]
+/// and j in [-count_y, count_y]; a count of kEndless repeats forever, a count of 0 not at all.
+/// With mirror set, copies in odd rows and columns are flipped, so neighbouring copies meet seamlessly
+class GridRepetition final: public SDF {
+    std::shared_ptr<SDF> child_;
+    double period_x_, period_y_;
+    int count_x_, count_y_;
+    bool mirror_;
+
+    void toCell(double x, double y, double& local_x, double& local_y) const {
+        double cell_x = RepetitionCell(x, period_x_, count_x_);
+        double cell_y = RepetitionCell(y, period_y_, count_y_);
+        local_x = x - cell_x * period_x_;
+        local_y = y - cell_y * period_y_;
+        if (mirror_) {
+            local_x = std::fmod(cell_x, 2.0) != 0 ? -local_x : local_x;
+            local_y = std::fmod(cell_y, 2.0) != 0 ? -local_y : local_y;
+        }
+    }
+public:
+    GridRepetition(std::shared_ptr<SDF> child, double period_x, double period_y,
+                   int count_x=kEndless, int count_y=kEndless, bool mirror=false):
+        child_(std::move(child)),
+        period_x_(period_x),
+        period_y_(period_y),
+        count_x_(count_x),
+        count_y_(count_y),
+        mirror_(mirror)
+    {
+        if ((count_x != 0 && !(period_x > 0)) || (count_y != 0 && !(period_y > 0))) {
+            std::cerr << "Repetition period must be positive" << std::endl;
+            exit(1);
+        }
+        if (count_x < kEndless || count_y < kEndless) {
+            std::cerr << "Repetition count must be kEndless or non-negative" << std::endl;
+            exit(1);
+        }
+    }
+
+    double distance(double x, double y) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->distance(local_x, local_y);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->getColor(local_x, local_y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->getLinearColor(local_x, local_y);
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->edgeDistance(local_x, local_y, eps);
+    }
+
+    Bounds bounds() const override {
+        Bounds box = child_->bounds();
+        if (box.empty()) {
+            return box;
+        }
+        if (mirror_) {
+            box = box.united({-box.x_max, -box.x_min, -box.y_max, -box.y_min});
+        }
+        auto [x_min, x_max] = RepeatedRange(box.x_min, box.x_max, period_x_, count_x_);
+        auto [y_min, y_max] = RepeatedRange(box.y_min, box.y_max, period_y_, count_y_);
+        return {x_min, x_max, y_min, y_max};
+    }
+};
+
+/// count copies of the child rotated around (center_x, center_y) by multiples of 2 pi / count,
+/// the copy at angle 0 being the child itself
+class PolarRepetition final: public SDF {
+    std::shared_ptr<SDF> child_;
+    double center_x_, center_y_;
+    double sector_;
+    std::vector<std::pair<double, double>> rotations_; // cos and sin of the way back from each copy
+
+    void toCell(double x, double y, double& local_x, double& local_y) const {
+        double dx = x - center_x_, dy = y - center_y_;
+        auto copy = long(std::round(std::atan2(dy, dx) / sector_));
+        copy = (copy % long(rotations_.size()) + long(rotations_.size())) % long(rotations_.size());
+        if (copy == 0) {
+            local_x = x;
+            local_y = y;
+            return;
+        }
+        auto [cos, sin] = rotations_[size_t(copy)];
+        local_x = center_x_ + cos * dx - sin * dy;
+        local_y = center_y_ + sin * dx + cos * dy;
+    }
+public:
+    PolarRepetition(std::shared_ptr<SDF> child, int count, double center_x=0.0, double center_y=0.0):
+        child_(std::move(child)),
+        center_x_(center_x),
+        center_y_(center_y),
+        sector_(2 * M_PI / count)
+    {
+        if (count <= 0) {
+            std::cerr << "Polar repetition needs at least one copy" << std::endl;
+            exit(1);
+        }
+        for (int copy = 0; copy < count; ++copy) {
+            double angle = -copy * sector_;
+            rotations_.emplace_back(std::cos(angle), std::sin(angle));
+        }
+    }
+
+    double distance(double x, double y) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->distance(local_x, local_y);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->getColor(local_x, local_y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->getLinearColor(local_x, local_y);
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        double local_x, local_y;
+        toCell(x, y, local_x, local_y);
+        return child_->edgeDistance(local_x, local_y, eps);
+    }
+
+    Bounds bounds() const override {
+        Bounds box = child_->bounds();
+        if (box.empty() || rotations_.size() == 1) {
+            return box;
+        }
+        // every copy stays within the child's farthest corner from the center
+        double reach_x = std::max(std::abs(box.x_min - center_x_), std::abs(box.x_max - center_x_));
+        double reach_y = std::max(std::abs(box.y_min - center_y_), std::abs(box.y_max - center_y_));
+        double reach = std::hypot(reach_x, reach_y);
+        return {center_x_ - reach, center_x_ + reach, center_y_ - reach, center_y_ + reach};
+    }
+};
+
+#endif //SDF_REPETITION_H
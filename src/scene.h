@@ -4,8 +4,76 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 #include "distance_functions.h"
 #include "image.h"
+#include "parallel.h"
+#include "uniform_grid.h"
+
+/// Sample positions inside a pixel, in pixels relative to the pixel's regular sample point
+struct SamplePattern {
+    std::vector<std::pair<double, double>> offsets;
+
+    /// n x n regular grid
+    static SamplePattern Grid(int n) {
+        SamplePattern pattern;
+        for (int a = 0; a < n; ++a) {
+            for (int b = 0; b < n; ++b) {
+                pattern.offsets.emplace_back((a + 0.5) / n - 0.5, (b + 0.5) / n - 0.5);
+            }
+        }
+        return pattern;
+    }
+
+    /// 4 samples on a rotated grid, every row and column of the pixel sees a different sample
+    static SamplePattern RotatedGrid() {
+        return {{{-0.375, -0.125}, {-0.125, 0.375}, {0.125, -0.375}, {0.375, 0.125}}};
+    }
+};
+
+/// Pixels [row_begin, row_end) x [col_begin, col_end) of an image
+struct PixelRect {
+    size_t row_begin, row_end, col_begin, col_end;
+
+    static PixelRect Whole(size_t height, size_t width) {
+        return {0, height, 0, width};
+    }
+
+    bool empty() const {
+        return row_begin >= row_end || col_begin >= col_end;
+    }
+};
+
+/// Pixels of a height x width render of view whose samples fall into box. Pixel k samples
+/// min + k / count * (max - min) like the renderers, one more pixel on each side keeps rounding
+/// from losing a sample on the edge of the box
+PixelRect PixelsCovering(const Bounds& box, const Bounds& view, size_t height, size_t width) {
+    if (box.empty()) {
+        return {0, 0, 0, 0};
+    }
+    auto samples = [](double low, double high, double min, double max, size_t count) {
+        double scale = count / (max - min);
+        double begin = std::clamp(std::floor((low - min) * scale) - 1, 0.0, double(count));
+        double end = std::clamp(std::floor((high - min) * scale) + 2, 0.0, double(count));
+        return std::make_pair(size_t(begin), size_t(end));
+    };
+    auto [row_begin, row_end] = samples(box.y_min, box.y_max, view.y_min, view.y_max, height);
+    auto [col_begin, col_end] = samples(box.x_min, box.x_max, view.x_min, view.x_max, width);
+    return {row_begin, row_end, col_begin, col_end};
+}
+
+/// A point of the plane, see Scene::queryDistance
+struct Point {
+    double x, y;
+};
+
+struct AdaptiveSamplingOptions {
+    SamplePattern pattern = SamplePattern::Grid(4);
+    double edge_width = 1.0; // pixels closer than this many pixel sizes to an edge get supersampled
+};
 
 class Scene {
     std::vector<std::shared_ptr<SDF>> objects_;             // all objects in the scene
@@ -21,30 +89,501 @@ public:
         background_(background)
     {}
 
+    /// Objects front to back
+    const std::vector<std::shared_ptr<SDF>>& objects() const {
+        return objects_;
+    }
+
+    /// The part of the plane the image shows
+    Bounds view() const {
+        return {x_min_, x_max_, y_min_, y_max_};
+    }
+
+    RGBColor background() const {
+        return background_;
+    }
+
+    /// Color of the first object closer than eps to the point, background if there is none
+    RGBColor ShadePixel(double x, double y, double eps) const {
+        for (const auto& object : objects_) {
+            if (object->distance(x, y) < eps) {
+                return object->getColor(x, y);
+            }
+        }
+        return background_;
+    }
+
+    LinearColor ShadeLinearPixel(double x, double y, double eps) const {
+        for (const auto& object : objects_) {
+            if (object->distance(x, y) < eps) {
+                return object->getLinearColor(x, y);
+            }
+        }
+        return ToLinear(background_);
+    }
+
+    /// For every point the distance to the nearest object and that object's index in objects(), ties going
+    /// to the earlier object; infinity and -1 if there are no objects or the point isn't finite. Points are
+    /// sorted along a Morton curve and cut into batches of close points. A batch looks up the objects around it
+    /// in a uniform grid over their bounds and evaluates each of them for all its points with one SDF::distances
+    /// call. Batches run on all cores. The grid is built on every call, so query many points at once
+    void queryDistance(const Point* points, size_t count, float* distances, int* object_ids) const {
+        // objects with finite boxes go into the grid, the others are evaluated for every batch
+        std::vector<Bounds> boxes;
+        std::vector<uint32_t> gridded, unbounded;
+        for (size_t k = 0; k < objects_.size(); ++k) {
+            Bounds box = objects_[k]->bounds();
+            bool finite = std::isfinite(box.x_min) && std::isfinite(box.x_max) &&
+                          std::isfinite(box.y_min) && std::isfinite(box.y_max);
+            if (finite && !box.empty()) {
+                boxes.push_back(box);
+                gridded.push_back(uint32_t(k));
+            } else {
+                unbounded.push_back(uint32_t(k));
+            }
+        }
+        // a few objects are cheaper to evaluate everywhere than to sort the points for
+        if (gridded.size() <= kQuerySortObjects) {
+            unbounded.insert(unbounded.end(), gridded.begin(), gridded.end());
+            gridded.clear();
+        }
+        UniformGrid grid;
+        if (!gridded.empty()) {
+            grid = UniformGrid(boxes, kQueryObjectsPerCell);
+        }
+
+        // points that aren't finite are nowhere near any object, the others are queried in Morton order over
+        // their extent, key in the high half and the point in the low half. Without a grid they keep their order
+        Bounds extent = Bounds::Empty();
+        std::vector<uint64_t> order;
+        order.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (std::isfinite(points[i].x) && std::isfinite(points[i].y)) {
+                extent = extent.united({points[i].x, points[i].x, points[i].y, points[i].y});
+                order.push_back(i);
+            } else {
+                distances[i] = std::numeric_limits<float>::infinity();
+                object_ids[i] = -1;
+            }
+        }
+        if (!gridded.empty()) {
+            double scale_x = extent.x_max > extent.x_min ? 65535 / (extent.x_max - extent.x_min) : 0.0;
+            double scale_y = extent.y_max > extent.y_min ? 65535 / (extent.y_max - extent.y_min) : 0.0;
+            for (uint64_t& entry : order) {
+                const Point& point = points[uint32_t(entry)];
+                uint32_t key = SpreadBits(uint32_t((point.x - extent.x_min) * scale_x)) |
+                               SpreadBits(uint32_t((point.y - extent.y_min) * scale_y)) << 1;
+                entry |= uint64_t(key) << 32;
+            }
+            std::sort(order.begin(), order.end());
+        }
+
+        // a batch ends after kQueryBatch points or where the points leave a Morton cell a few objects wide,
+        // sparse points would otherwise make a batch so large that every object is evaluated at far points
+        int cell_bits = 0;
+        if (!gridded.empty()) {
+            const Bounds& area = grid.bounds();
+            double spacing = std::sqrt((area.x_max - area.x_min) * (area.y_max - area.y_min) / gridded.size());
+            double side = std::max(extent.x_max - extent.x_min, extent.y_max - extent.y_min);
+            if (spacing > 0 && side > 0) {
+                cell_bits = int(std::clamp(std::ceil(std::log2(side / (kQueryCellObjects * spacing))), 0.0, 16.0));
+            }
+        }
+        int shift = 64 - 2 * cell_bits;
+        std::vector<size_t> batch_starts;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (batch_starts.empty() || i - batch_starts.back() == kQueryBatch ||
+                (cell_bits > 0 && order[i] >> shift != order[i - 1] >> shift)) {
+                batch_starts.push_back(i);
+            }
+        }
+        batch_starts.push_back(order.size());
+
+        ParallelFor(batch_starts.size() - 1, [&](size_t first_batch, size_t last_batch) {
+            std::vector<uint32_t> seen(gridded.size(), 0); // batch + 1 once a batch looked at the object
+            double xs[kQueryBatch], ys[kQueryBatch], values[kQueryBatch], best[kQueryBatch];
+            int best_ids[kQueryBatch];
+            for (size_t b = first_batch; b < last_batch; ++b) {
+                size_t begin = batch_starts[b], size = batch_starts[b + 1] - begin;
+                Bounds box = Bounds::Empty();
+                for (size_t k = 0; k < size; ++k) {
+                    const Point& point = points[uint32_t(order[begin + k])];
+                    xs[k] = point.x;
+                    ys[k] = point.y;
+                    box = box.united({point.x, point.x, point.y, point.y});
+                    best[k] = std::numeric_limits<double>::infinity();
+                    best_ids[k] = -1;
+                }
+                // no object farther from the whole batch than its worst point's best can win anywhere in it
+                double worst = std::numeric_limits<double>::infinity();
+                auto consider = [&](uint32_t object) {
+                    objects_[object]->distances(xs, ys, size, values);
+                    worst = 0.0;
+                    for (size_t k = 0; k < size; ++k) {
+                        if (values[k] < best[k] || (values[k] == best[k] && int(object) < best_ids[k])) {
+                            best[k] = values[k];
+                            best_ids[k] = int(object);
+                        }
+                        worst = std::max(worst, best[k]);
+                    }
+                };
+                for (uint32_t object : unbounded) {
+                    consider(object);
+                }
+                if (!gridded.empty()) {
+                    double center_x = (box.x_min + box.x_max) / 2, center_y = (box.y_min + box.y_max) / 2;
+                    double radius = std::hypot(box.x_max - box.x_min, box.y_max - box.y_min) / 2;
+                    const std::vector<uint32_t>& items = grid.items();
+                    grid.search(center_x, center_y, [&](size_t run_begin, size_t run_end) {
+                        for (size_t r = run_begin; r < run_end; ++r) {
+                            uint32_t item = items[r];
+                            if (seen[item] == b + 1) {
+                                continue;
+                            }
+                            seen[item] = uint32_t(b + 1);
+                            if (boxes[item].distance(box) <= worst) {
+                                consider(gridded[item]);
+                            }
+                        }
+                    }, [&](double bound) {
+                        return worst < bound - radius;
+                    });
+                }
+                for (size_t k = 0; k < size; ++k) {
+                    auto point = uint32_t(order[begin + k]);
+                    distances[point] = float(best[k]);
+                    object_ids[point] = best_ids[k];
+                }
+            }
+        }, 16);
+    }
+
+    /// Scene units covered by one pixel of an image with the given size
+    double PixelFootprint(size_t height, size_t width) const {
+        return std::max((x_max_ - x_min_) / width, (y_max_ - y_min_) / height);
+    }
+
+    /// Front to back composite of all objects with coverage derived from the signed distance:
+    /// an edge at distance d from the sample covers about 0.5 - d / footprint of the pixel.
+    /// The edge sits at distance eps, as in the hard test of ShadePixel.
+    /// Whatever an object leaves uncovered shows the objects below it and finally the background
+    LinearColor ShadeAntialiasedPixel(double x, double y, double footprint, double eps) const {
+        LinearColor color{0.f, 0.f, 0.f};
+        float transmittance = 1.f;
+        for (const auto& object : objects_) {
+            float coverage = float(std::clamp(0.5 - (object->distance(x, y) - eps) / footprint, 0.0, 1.0));
+            if (coverage > 0.f) {
+                LinearColor object_color = object->getLinearColor(x, y);
+                float weight = transmittance * coverage;
+                color.r += weight * object_color.r;
+                color.g += weight * object_color.g;
+                color.b += weight * object_color.b;
+                transmittance -= weight;
+                if (transmittance < kOpaqueTransmittance) {
+                    return color;
+                }
+            }
+        }
+        LinearColor background = ToLinear(background_);
+        color.r += transmittance * background.r;
+        color.g += transmittance * background.g;
+        color.b += transmittance * background.b;
+        return color;
+    }
+
     template<typename pixel_type>
     void RenderToImage(Image<pixel_type>& image, double eps=1e-3) {
         for (int i = 0; i < image.height_; ++i) {
             for (int j = 0; j < image.width_; ++j) {
-                double y = y_min_ + double(i) / image.width_ * (y_max_ - y_min_);
-                double x = x_min_ + double(j) / image.height_ * (x_max_ - x_min_);
+                double y = y_min_ + double(i) / image.height_ * (y_max_ - y_min_);
+                double x = x_min_ + double(j) / image.width_ * (x_max_ - x_min_);
 
-                std::shared_ptr<SDF> hit;
+                RGBColor color = ShadePixel(x, y, eps);
+                image(i, j, 0) = color.r;
+                image(i, j, 1) = color.g;
+                image(i, j, 2) = color.b;
+            }
+        }
+    }
+
+    /// Shades a whole row first and then writes it out with one pass of (aligned) stores
+    template<typename pixel_type, size_t channels>
+    void RenderToImage(AlignedImage<pixel_type, channels>& image, double eps=1e-3) {
+        RenderToImage(image, PixelRect::Whole(image.height_, image.width_), eps);
+    }
+
+    /// Renders only the pixels of rect, they come out exactly as in a render of the whole image
+    template<typename pixel_type, size_t channels>
+    void RenderToImage(AlignedImage<pixel_type, channels>& image, const PixelRect& rect, double eps=1e-3) {
+        static_assert(channels == 3 || channels == 4, "only RGB and RGBA images are supported");
+        std::vector<RGBColor> row_colors(rect.col_end - rect.col_begin);
+        for (size_t i = rect.row_begin; i < rect.row_end; ++i) {
+            double y = y_min_ + double(i) / image.height_ * (y_max_ - y_min_);
+            for (size_t j = rect.col_begin; j < rect.col_end; ++j) {
+                double x = x_min_ + double(j) / image.width_ * (x_max_ - x_min_);
+                row_colors[j - rect.col_begin] = ShadePixel(x, y, eps);
+            }
+            StoreRow<pixel_type, channels>(row_colors.data(), image.row(i) + rect.col_begin * channels, row_colors.size());
+        }
+    }
+
+    /// Float pipeline: linear colors are blended and stored without any rounding
+    template<size_t channels>
+    void RenderToImage(AlignedImage<float, channels>& image, double eps=1e-3) {
+        static_assert(channels == 3 || channels == 4, "only RGB and RGBA images are supported");
+        for (size_t i = 0; i < image.height_; ++i) {
+            double y = y_min_ + double(i) / image.height_ * (y_max_ - y_min_);
+            float* row = image.row(i);
+            for (size_t j = 0; j < image.width_; ++j) {
+                double x = x_min_ + double(j) / image.width_ * (x_max_ - x_min_);
+                LinearColor color = ShadeLinearPixel(x, y, eps);
+                float* pixel = row + j * channels;
+                pixel[0] = color.r;
+                pixel[1] = color.g;
+                pixel[2] = color.b;
+                if constexpr (channels == 4) {
+                    pixel[3] = 1.f;
+                }
+            }
+        }
+    }
+
+    /// One sample per pixel with analytic coverage instead of the hard distance < eps test,
+    /// edges come out smooth without rendering at a larger size
+    template<typename pixel_type, size_t channels>
+    void RenderToImageAntialiased(AlignedImage<pixel_type, channels>& image, double eps=1e-3) {
+        RenderToImageAntialiased(image, PixelRect::Whole(image.height_, image.width_), eps);
+    }
+
+    template<typename pixel_type, size_t channels>
+    void RenderToImageAntialiased(AlignedImage<pixel_type, channels>& image, const PixelRect& rect, double eps=1e-3) {
+        static_assert(channels == 3 || channels == 4, "only RGB and RGBA images are supported");
+        double footprint = PixelFootprint(image.height_, image.width_);
+        std::vector<LinearColor> row_colors(rect.col_end - rect.col_begin);
+        for (size_t i = rect.row_begin; i < rect.row_end; ++i) {
+            double y = y_min_ + double(i) / image.height_ * (y_max_ - y_min_);
+            for (size_t j = rect.col_begin; j < rect.col_end; ++j) {
+                double x = x_min_ + double(j) / image.width_ * (x_max_ - x_min_);
+                row_colors[j - rect.col_begin] = ShadeAntialiasedPixel(x, y, footprint, eps);
+            }
+            StoreLinearRow<pixel_type, channels>(row_colors.data(), image.row(i) + rect.col_begin * channels, row_colors.size());
+        }
+    }
+
+    /// One hard sample everywhere, then only pixels within options.edge_width pixels of an edge
+    /// (including seams inside Overlay and Intersection) are resampled with options.pattern.
+    /// Returns how many pixels were supersampled
+    template<typename pixel_type, size_t channels>
+    size_t RenderToImageAdaptive(AlignedImage<pixel_type, channels>& image, double eps=1e-3,
+                                 const AdaptiveSamplingOptions& options=AdaptiveSamplingOptions()) {
+        return RenderToImageAdaptive(image, PixelRect::Whole(image.height_, image.width_), eps, options);
+    }
+
+    template<typename pixel_type, size_t channels>
+    size_t RenderToImageAdaptive(AlignedImage<pixel_type, channels>& image, const PixelRect& rect, double eps=1e-3,
+                                 const AdaptiveSamplingOptions& options=AdaptiveSamplingOptions()) {
+        static_assert(channels == 3 || channels == 4, "only RGB and RGBA images are supported");
+        double step_x = (x_max_ - x_min_) / image.width_;
+        double step_y = (y_max_ - y_min_) / image.height_;
+        double edge_width = options.edge_width * PixelFootprint(image.height_, image.width_);
+        float sample_weight = 1.f / options.pattern.offsets.size();
+        std::vector<LinearColor> row_colors(rect.col_end - rect.col_begin);
+        size_t supersampled = 0;
+        for (size_t i = rect.row_begin; i < rect.row_end; ++i) {
+            double y = y_min_ + i * step_y;
+            for (size_t j = rect.col_begin; j < rect.col_end; ++j) {
+                double x = x_min_ + j * step_x;
+                SDF* hit = nullptr;
+                bool near_edge = false;
                 for (const auto& object : objects_) {
-                    if (object->distance(x, y) < eps) {
-                        hit = object;
+                    double distance = object->distance(x, y);
+                    near_edge = near_edge || std::abs(distance - eps) < edge_width;
+                    if (distance < eps) {
+                        hit = object.get();
                         break;
                     }
                 }
-                RGBColor color = background_;
-                if (hit) {
-                    color = hit->getColor(x, y);
+                if (!near_edge && hit) {
+                    near_edge = hit->edgeDistance(x, y, eps) < edge_width;
                 }
-                image(i, j, 0) = color.r;
-                image(i, j, 1) = color.g;
-                image(i, j, 2) = color.b;
+                if (!near_edge) {
+                    row_colors[j - rect.col_begin] = hit ? hit->getLinearColor(x, y) : ToLinear(background_);
+                    continue;
+                }
+                ++supersampled;
+                LinearColor sum{0.f, 0.f, 0.f};
+                for (const auto& [dy, dx] : options.pattern.offsets) {
+                    LinearColor sample = ShadeLinearPixel(x + dx * step_x, y + dy * step_y, eps);
+                    sum.r += sample.r;
+                    sum.g += sample.g;
+                    sum.b += sample.b;
+                }
+                row_colors[j - rect.col_begin] = {sum.r * sample_weight, sum.g * sample_weight, sum.b * sample_weight};
             }
+            StoreLinearRow<pixel_type, channels>(row_colors.data(), image.row(i) + rect.col_begin * channels, row_colors.size());
         }
+        return supersampled;
     }
+
+    /// Deferred shading. A coverage pass stores the front object and its distance for every pixel
+    /// in a G-buffer, then pixels are grouped by object and each group is shaded in batches
+    /// through SDF::getColors. Both passes run on all cores
+    template<typename pixel_type, size_t channels>
+    void RenderToImageDeferred(AlignedImage<pixel_type, channels>& image, double eps=1e-3) {
+        static_assert(channels == 3 || channels == 4, "only RGB and RGBA images are supported");
+        const size_t width = image.width_, height = image.height_;
+        const auto background_id = uint32_t(objects_.size());
+        std::vector<uint32_t> object_ids(width * height); // G-buffer, background_id where nothing was hit
+        std::vector<double> distances(width * height); // full precision, border tests compare against it
+
+        ParallelFor(height, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                double y = y_min_ + double(i) / height * (y_max_ - y_min_);
+                for (size_t j = 0; j < width; ++j) {
+                    double x = x_min_ + double(j) / width * (x_max_ - x_min_);
+                    uint32_t id = background_id;
+                    double distance = 0.0;
+                    for (uint32_t k = 0; k < background_id; ++k) {
+                        distance = objects_[k]->distance(x, y);
+                        if (distance < eps) {
+                            id = k;
+                            break;
+                        }
+                    }
+                    object_ids[i * width + j] = id;
+                    distances[i * width + j] = distance;
+                }
+            }
+        }, 16);
+
+        // counting sort by object, pixels of one object stay in scan order
+        std::vector<uint32_t> starts(background_id + 2, 0);
+        for (uint32_t id : object_ids) {
+            ++starts[id + 1];
+        }
+        for (size_t k = 1; k < starts.size(); ++k) {
+            starts[k] += starts[k - 1];
+        }
+        std::vector<uint32_t> order(object_ids.size());
+        {
+            std::vector<uint32_t> cursor(starts.begin(), starts.end() - 1);
+            for (uint32_t pixel = 0; pixel < object_ids.size(); ++pixel) {
+                order[cursor[object_ids[pixel]]++] = pixel;
+            }
+        }
+
+        struct Batch {
+            uint32_t id, begin, end; // range in order
+        };
+        std::vector<Batch> batches;
+        for (uint32_t id = 0; id <= background_id; ++id) {
+            for (uint32_t begin = starts[id]; begin < starts[id + 1]; begin += kShadingBatch) {
+                batches.push_back({id, begin, std::min<uint32_t>(starts[id + 1], begin + kShadingBatch)});
+            }
+        }
+
+        ParallelFor(batches.size(), [&](size_t first_batch, size_t last_batch) {
+            double xs[kShadingBatch], ys[kShadingBatch], batch_distances[kShadingBatch];
+            std::conditional_t<std::is_same_v<pixel_type, float>, LinearColor, RGBColor> colors[kShadingBatch];
+            for (size_t b = first_batch; b < last_batch; ++b) {
+                const Batch& batch = batches[b];
+                size_t count = batch.end - batch.begin;
+                if (batch.id == background_id) {
+                    for (size_t k = 0; k < count; ++k) {
+                        if constexpr (std::is_same_v<pixel_type, float>) {
+                            colors[k] = ToLinear(background_);
+                        } else {
+                            colors[k] = background_;
+                        }
+                    }
+                } else {
+                    for (size_t k = 0; k < count; ++k) {
+                        uint32_t pixel = order[batch.begin + k];
+                        xs[k] = x_min_ + double(pixel % width) / width * (x_max_ - x_min_);
+                        ys[k] = y_min_ + double(pixel / width) / height * (y_max_ - y_min_);
+                        batch_distances[k] = distances[pixel];
+                    }
+                    if constexpr (std::is_same_v<pixel_type, float>) {
+                        objects_[batch.id]->getLinearColors(xs, ys, batch_distances, count, colors);
+                    } else {
+                        objects_[batch.id]->getColors(xs, ys, batch_distances, count, colors);
+                    }
+                }
+                for (size_t k = 0; k < count; ++k) {
+                    uint32_t pixel = order[batch.begin + k];
+                    pixel_type* out = image.row(pixel / width) + (pixel % width) * channels;
+                    out[0] = colors[k].r;
+                    out[1] = colors[k].g;
+                    out[2] = colors[k].b;
+                    if constexpr (channels == 4) {
+                        out[3] = std::is_same_v<pixel_type, float> ? pixel_type(1) : std::numeric_limits<pixel_type>::max();
+                    }
+                }
+            }
+        });
+    }
+
+    /// Writes a row of shaded linear colors to an image row, also used by StaticScene
+    template<typename pixel_type, size_t channels>
+    static void StoreLinearRow(const LinearColor* colors, pixel_type* row, size_t width) {
+        static_assert(sizeof(LinearColor) == 3 * sizeof(float), "LinearColor must be tightly packed");
+        const float* values = reinterpret_cast<const float*>(colors);
+        if constexpr (std::is_same_v<pixel_type, uint8_t> && channels == 3) {
+            QuantizeLinearTo8bit(values, row, width * 3);
+        } else if constexpr (std::is_same_v<pixel_type, float> && channels == 3) {
+            std::memcpy(row, values, width * sizeof(LinearColor));
+        } else {
+            for (size_t j = 0; j < width; ++j) {
+                pixel_type* pixel = row + j * channels;
+                if constexpr (std::is_same_v<pixel_type, float>) {
+                    pixel[0] = colors[j].r;
+                    pixel[1] = colors[j].g;
+                    pixel[2] = colors[j].b;
+                    pixel[3] = 1.f;
+                } else {
+                    QuantizeLinearTo8bit(values + 3 * j, pixel, 3);
+                    pixel[3] = std::numeric_limits<uint8_t>::max();
+                }
+            }
+        }
+    }
+
+    /// Writes a row of 8 bit colors to an image row
+    template<typename pixel_type, size_t channels>
+    static void StoreRow(const RGBColor* colors, pixel_type* row, size_t width) {
+        if constexpr (std::is_same_v<pixel_type, uint8_t> && channels == 3) {
+            static_assert(sizeof(RGBColor) == 3, "RGBColor must be tightly packed");
+            std::memcpy(row, colors, width * sizeof(RGBColor));
+        } else {
+            for (size_t j = 0; j < width; ++j) {
+                pixel_type* pixel = row + j * channels;
+                pixel[0] = colors[j].r;
+                pixel[1] = colors[j].g;
+                pixel[2] = colors[j].b;
+                if constexpr (channels == 4) {
+                    pixel[3] = std::numeric_limits<uint8_t>::max();
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t kShadingBatch = 256;
+    static constexpr size_t kQueryBatch = 64;
+    static constexpr size_t kQueryObjectsPerCell = 4;
+    static constexpr size_t kQuerySortObjects = 16;
+    static constexpr double kQueryCellObjects = 4; // side of a batch's Morton cell in average object spacings
+
+    /// The low 16 bits of value spread to the even bits
+    static uint32_t SpreadBits(uint32_t value) {
+        value &= 0xffff;
+        value = (value | value << 8) & 0x00ff00ff;
+        value = (value | value << 4) & 0x0f0f0f0f;
+        value = (value | value << 2) & 0x33333333;
+        return (value | value << 1) & 0x55555555;
+    }
+
+    static constexpr float kOpaqueTransmittance = 1.f / 1024; // less than any output format can show
 };
 
 #endif //SDF_SCENE_H
@@ -0,0 +1 @@
+#include "scene_builder.h"
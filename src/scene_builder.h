@@ -0,0 +1,554 @@
+#ifndef SDF_SCENE_BUILDER_H
+#define SDF_SCENE_BUILDER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <optional>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "distance_functions.h"
+#include "flat_scene.h"
+#include "scene.h"
+
+using NodeId = uint32_t;
+
+/// All nodes of a built scene in one allocation, laid out in depth-first order.
+/// Composites refer to their children by index, the nodes die together with the arena
+class NodeArena {
+    static constexpr size_t kAlignment = 64;
+
+    void* block_ = nullptr;
+    SDF** nodes_ = nullptr;  // index -> node, stored at the start of the block
+    size_t node_count_ = 0;
+    size_t constructed_ = 0;
+    size_t bytes_ = 0;
+    std::vector<std::shared_ptr<SDF>> external_; // Custom nodes, they live outside the block
+
+    friend class SceneBuilder;
+public:
+    NodeArena(size_t node_count, size_t node_bytes): node_count_(node_count) {
+        bytes_ = (node_count * sizeof(SDF*) + kAlignment - 1) / kAlignment * kAlignment + node_bytes;
+        block_ = ::operator new(bytes_, std::align_val_t(kAlignment));
+        nodes_ = static_cast<SDF**>(block_);
+    }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    ~NodeArena() {
+        for (size_t i = constructed_; i-- > 0;) {
+            if (!isExternal(nodes_[i])) {
+                nodes_[i]->~SDF();
+            }
+        }
+        ::operator delete(block_, std::align_val_t(kAlignment));
+    }
+
+    SDF* node(NodeId id) const {
+        return nodes_[id];
+    }
+
+    size_t size() const {
+        return node_count_;
+    }
+
+    /// Bytes of the single allocation behind the scene
+    size_t bytes() const {
+        return bytes_;
+    }
+
+    bool isExternal(const SDF* node) const {
+        auto begin = static_cast<const std::byte*>(block_);
+        auto address = reinterpret_cast<const std::byte*>(node);
+        return address < begin || address >= begin + bytes_;
+    }
+};
+
+/// Child reference of arena composites, an index into the arena's node table
+class ArenaRef {
+    const NodeArena* arena_;
+    NodeId id_;
+public:
+    ArenaRef(const NodeArena* arena, NodeId id): arena_(arena), id_(id) {}
+
+    SDF* operator->() const {
+        return arena_->node(id_);
+    }
+
+    NodeId id() const {
+        return id_;
+    }
+};
+
+using ArenaIntersection = BasicIntersection<ArenaRef>;
+using ArenaOverlay = BasicOverlay<ArenaRef>;
+
+/// How SceneBuilder lays out the nodes it builds
+enum class SceneRepresentation {
+    Arena, // SDF objects specialized on their shading variant, children by index, virtual calls
+    Flat,  // FlatNode records evaluated with a switch, virtual calls only for Custom nodes
+};
+
+/// What SceneBuilder::optimize did. Node counts are of the nodes the objects reach
+struct OptimizeStats {
+    size_t nodes_before = 0;
+    size_t nodes_after = 0;
+    size_t flattened = 0; // nested intersections merged into their parent
+    size_t culled = 0;    // subtrees dropped because they can't reach the viewport
+    size_t folded = 0;    // intersections left with a single child or repeating one
+};
+
+/// Collects a scene description and builds it into a NodeArena or a FlatScene.
+/// The add* calls only record nodes; build() orders the nodes depth first from the objects
+/// and lays them out in one go. Nodes no object reaches are dropped.
+/// optimize() rewrites the recorded graph before that, build() takes whatever it left
+class SceneBuilder {
+    struct Node {
+        FlatNode node;
+        std::vector<NodeId> children;
+    };
+
+    struct Layout {
+        size_t size, alignment;
+    };
+
+    /// The node arrays of a FlatScene while emitFlat fills them
+    struct FlatArrays {
+        std::vector<FlatNode> nodes;
+        std::vector<uint32_t> children;
+    };
+
+    /// A subtree after optimize(), id replaces the subtree's root in its parents
+    struct Simplified {
+        NodeId id;
+        Bounds bounds;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<Color> colors_;
+    ColorRecordSet color_records_; // equal colors are stored once, however many primitives use them
+    std::vector<std::shared_ptr<const SDFTexture>> textures_;
+    std::map<std::string, uint32_t> texture_ids_; // files are loaded once, however many images show them
+    std::vector<std::shared_ptr<SDF>> custom_;
+    std::vector<NodeId> objects_;
+
+    static constexpr NodeId kUnassigned = ~NodeId(0);
+
+    NodeId push(FlatNode node, std::vector<NodeId> children={}) {
+        nodes_.push_back({node, std::move(children)});
+        return NodeId(nodes_.size() - 1);
+    }
+
+    NodeId addPrimitive(NodeKind kind, std::initializer_list<double> params, const Color& color) {
+        FlatNode node;
+        node.kind = kind;
+        node.color = color_records_.insert(color.record());
+        if (node.color == colors_.size()) {
+            colors_.push_back(color);
+        }
+        std::copy(params.begin(), params.end(), node.params);
+        return push(node);
+    }
+
+    /// Calls visitor(static_cast<T*>(nullptr), constructor arguments...) with the SDF type
+    /// the arena holds for node, specialized on the node's shading variant
+    template<typename Visitor>
+    auto visitArenaType(const Node& node, const NodeArena* arena, const NodeId* children, Visitor&& visitor) const {
+        const FlatNode& flat = node.node;
+        const double* p = flat.params;
+        const Color& color = colors_[flat.color];
+        switch (flat.kind) {
+            case NodeKind::Circle:
+                return color.visit([&](auto shading) {
+                    return visitor(static_cast<BasicCircle<decltype(shading)>*>(nullptr), p[0], p[1], p[2], shading);
+                });
+            case NodeKind::AxisAlignedRectangle:
+                return color.visit([&](auto shading) {
+                    return visitor(static_cast<BasicAxisAlignedRectangle<decltype(shading)>*>(nullptr),
+                                   p[0], p[1], p[2], p[3], shading);
+                });
+            case NodeKind::AxisAlignedEquilateralTriangle:
+                return color.visit([&](auto shading) {
+                    return visitor(static_cast<BasicAxisAlignedEquilateralTriangle<decltype(shading)>*>(nullptr),
+                                   p[0], p[1], p[2], shading);
+                });
+            case NodeKind::SDFImage:
+                return color.visit([&](auto shading) {
+                    return visitor(static_cast<BasicSDFImage<decltype(shading)>*>(nullptr),
+                                   textures_[flat.resource], p[0], p[1], p[2], shading);
+                });
+            case NodeKind::Segment:
+                return visitor(static_cast<Segment*>(nullptr), p[0], p[1], p[2], p[3], color.getColor());
+            case NodeKind::Intersection:
+                return visitor(static_cast<ArenaIntersection*>(nullptr),
+                               ArenaRef(arena, children[0]), ArenaRef(arena, children[1]), flat.smooth, p[0]);
+            default:
+                return visitor(static_cast<ArenaOverlay*>(nullptr),
+                               ArenaRef(arena, children[0]), ArenaRef(arena, children[1]), p[0]);
+        }
+    }
+
+    void order(NodeId id, std::vector<NodeId>& final_ids, std::vector<NodeId>& sequence) const {
+        if (final_ids[id] != kUnassigned) {
+            return; // shared subtree, already placed
+        }
+        final_ids[id] = NodeId(sequence.size());
+        sequence.push_back(id);
+        for (NodeId child : nodes_[id].children) {
+            order(child, final_ids, sequence);
+        }
+    }
+
+    /// Depth first order of the nodes reachable from the objects, final_ids maps builder ids to it
+    std::vector<NodeId> order(std::vector<NodeId>& final_ids) const {
+        final_ids.assign(nodes_.size(), kUnassigned);
+        std::vector<NodeId> sequence;
+        for (NodeId object : objects_) {
+            order(object, final_ids, sequence);
+        }
+        return sequence;
+    }
+
+    Bounds primitiveBounds(const FlatNode& node) const {
+        switch (node.kind) {
+            case NodeKind::SDFImage:
+                return PrimitiveBounds(node, textures_[node.resource].get());
+            case NodeKind::Custom:
+                return custom_[node.resource]->bounds();
+            default:
+                return PrimitiveBounds(node, nullptr);
+        }
+    }
+
+    /// Marks the nodes below smooth intersections: the blend reads their distances even where
+    /// they are far from the surface, so nothing may be culled from them
+    void markBlended(NodeId id, bool blended, std::vector<uint8_t>& marks) const {
+        uint8_t mark = blended ? 2 : 1;
+        if (marks[id] >= mark) {
+            return;
+        }
+        marks[id] = mark;
+        const FlatNode& node = nodes_[id].node;
+        for (NodeId child : nodes_[id].children) {
+            markBlended(child, blended || (node.kind == NodeKind::Intersection && node.smooth), marks);
+        }
+    }
+
+    /// Rewrites id's subtree in place. A subtree whose bounds miss reach has distance >= margin
+    /// all over the viewport, it never gets hit or anti-aliased and can go wherever min() drops it
+    Simplified simplify(NodeId id, const Bounds& reach, std::vector<uint32_t>& references,
+                        const std::vector<uint8_t>& marks, std::vector<std::optional<Simplified>>& done,
+                        OptimizeStats& stats) {
+        if (done[id]) {
+            return *done[id];
+        }
+        const FlatNode flat = nodes_[id].node;
+        Simplified result{id, primitiveBounds(flat)};
+        if (flat.kind == NodeKind::Overlay) {
+            // both children stay: the overlay colors pixels near its bottom with its top
+            result.bounds = Bounds::Empty();
+            for (NodeId& child : nodes_[id].children) {
+                Simplified simplified = simplify(child, reach, references, marks, done, stats);
+                child = simplified.id;
+                result.bounds = result.bounds.united(simplified.bounds);
+            }
+        } else if (flat.kind == NodeKind::Intersection) {
+            result.bounds = Bounds::Empty();
+            std::vector<NodeId> children;
+            for (NodeId child : std::vector<NodeId>(nodes_[id].children)) {
+                Simplified simplified = simplify(child, reach, references, marks, done, stats);
+                if (!flat.smooth && marks[id] != 2 && !simplified.bounds.intersects(reach)) {
+                    ++stats.culled;
+                    continue;
+                }
+                result.bounds = result.bounds.united(simplified.bounds);
+                // min is associative, the smooth blend only folds from the left
+                const Node& nested = nodes_[simplified.id];
+                if (nested.node.kind == NodeKind::Intersection && references[simplified.id] == 1 &&
+                    nested.node.smooth == flat.smooth &&
+                    (!flat.smooth || (children.empty() && nested.node.params[0] == flat.params[0]))) {
+                    children.insert(children.end(), nested.children.begin(), nested.children.end());
+                    ++stats.flattened;
+                } else {
+                    children.push_back(simplified.id);
+                }
+            }
+            if (!flat.smooth) {
+                // ties go to the later child, so of repeated children only the last one counts
+                for (size_t k = children.size(); k-- > 0;) {
+                    if (std::find(children.begin() + k + 1, children.end(), children[k]) != children.end()) {
+                        children.erase(children.begin() + k);
+                        ++stats.folded;
+                    }
+                }
+            } else {
+                // every step of the fold may dip below the min
+                result.bounds = result.bounds.padded(SmoothBlendPadding(flat.params[0]) * double(children.size() - 1));
+            }
+            if (children.size() == 1) {
+                ++stats.folded;
+                references[children[0]] += references[id] - 1;
+                result.id = children[0];
+            } else if (!children.empty()) {
+                nodes_[id].children = std::move(children);
+            }
+        }
+        done[id] = result;
+        return result;
+    }
+
+    /// Arena intersections are binary, so wider ones become left-deep chains, which fold the same way
+    void splitWideIntersections() {
+        for (NodeId id = 0, count = NodeId(nodes_.size()); id < count; ++id) {
+            if (nodes_[id].node.kind != NodeKind::Intersection || nodes_[id].children.size() <= 2) {
+                continue;
+            }
+            std::vector<NodeId> children = std::move(nodes_[id].children);
+            FlatNode link = nodes_[id].node;
+            NodeId chain = push(link, {children[0], children[1]});
+            for (size_t k = 2; k + 1 < children.size(); ++k) {
+                chain = push(link, {chain, children[k]});
+            }
+            nodes_[id].children = {chain, children.back()};
+        }
+    }
+
+    NodeId emitFlat(NodeId id, FlatArrays& arrays, FlatScene& scene, std::vector<uint32_t>& color_ids) const {
+        const Node& source = nodes_[id];
+        auto flat_id = NodeId(arrays.nodes.size());
+        FlatNode node = source.node;
+        if (node.kind != NodeKind::Intersection && node.kind != NodeKind::Overlay && node.kind != NodeKind::Custom) {
+            // keep only the colors of nodes that made it into the scene
+            if (color_ids[node.color] == kUnassigned) {
+                color_ids[node.color] = uint32_t(scene.colors.size());
+                scene.colors.push_back(colors_[node.color]);
+            }
+            node.color = color_ids[node.color];
+        }
+        arrays.nodes.push_back(node);
+
+        std::vector<uint32_t> children;
+        for (NodeId child : source.children) {
+            children.push_back(emitFlat(child, arrays, scene, color_ids));
+        }
+        FlatNode& placed = arrays.nodes[flat_id];
+        placed.first_child = uint32_t(arrays.children.size());
+        placed.child_count = uint32_t(children.size());
+        placed.subtree_end = uint32_t(arrays.nodes.size());
+        arrays.children.insert(arrays.children.end(), children.begin(), children.end());
+        return flat_id;
+    }
+public:
+    NodeId addCircle(double x, double y, double radius, const Color& color) {
+        return addPrimitive(NodeKind::Circle, {x, y, radius}, color);
+    }
+
+    NodeId addAxisAlignedRectangle(double x, double y, double width, double height, const Color& color) {
+        return addPrimitive(NodeKind::AxisAlignedRectangle, {x, y, width, height}, color);
+    }
+
+    NodeId addSegment(double a_x, double a_y, double b_x, double b_y, RGBColor color) {
+        return addPrimitive(NodeKind::Segment, {a_x, a_y, b_x, b_y}, Color(color));
+    }
+
+    NodeId addAxisAlignedEquilateralTriangle(double x, double y, double radius, const Color& color) {
+        return addPrimitive(NodeKind::AxisAlignedEquilateralTriangle, {x, y, radius, radius * 2 / std::sqrt(3)}, color);
+    }
+
+    NodeId addSDFImage(const std::string& filepath, double x, double y, double scale, const Color& color) {
+        auto [it, inserted] = texture_ids_.emplace(filepath, uint32_t(textures_.size()));
+        if (inserted) {
+            textures_.push_back(LoadSDFTexture(filepath));
+        }
+        const SDFTexture& texture = *textures_[it->second];
+        NodeId id = addPrimitive(NodeKind::SDFImage,
+                                 {x, y, scale,
+                                  x - scale * texture.width / texture.max_side / 2,
+                                  y - scale * texture.height / texture.max_side / 2}, color);
+        nodes_[id].node.resource = it->second;
+        return id;
+    }
+
+    NodeId addIntersection(NodeId first, NodeId second, bool smooth=false, double smoothness=0.125) {
+        FlatNode node;
+        node.kind = NodeKind::Intersection;
+        node.smooth = smooth;
+        node.params[0] = smoothness;
+        return push(node, {first, second});
+    }
+
+    NodeId addOverlay(NodeId top, NodeId bottom, double alpha=0.5) {
+        FlatNode node;
+        node.kind = NodeKind::Overlay;
+        node.params[0] = alpha;
+        return push(node, {top, bottom});
+    }
+
+    /// Any other SDF, e.g. a user defined shape. It stays where it is and the scene keeps it alive
+    NodeId addExternal(std::shared_ptr<SDF> object) {
+        FlatNode node;
+        node.kind = NodeKind::Custom;
+        node.resource = uint32_t(custom_.size());
+        custom_.push_back(std::move(object));
+        return push(node);
+    }
+
+    /// Adds a top level object, objects added first are drawn on top like in Scene
+    void addObject(NodeId root) {
+        objects_.push_back(root);
+    }
+
+    size_t nodeCount() const {
+        return nodes_.size();
+    }
+
+    /// Simplifies the graph for a viewport: chains of intersections become one n-ary node, subtrees
+    /// that can't come within margin of the viewport are dropped, and so are intersections left with
+    /// a single child. As long as margin covers eps and the anti-aliasing footprint the rendered image
+    /// stays the same
+    OptimizeStats optimize(double x_min, double x_max, double y_min, double y_max, double margin) {
+        OptimizeStats stats;
+        std::vector<NodeId> final_ids;
+        stats.nodes_before = order(final_ids).size();
+
+        std::vector<uint32_t> references(nodes_.size(), 0);
+        for (NodeId id = 0; id < nodes_.size(); ++id) {
+            if (final_ids[id] != kUnassigned) {
+                for (NodeId child : nodes_[id].children) {
+                    ++references[child];
+                }
+            }
+        }
+        for (NodeId object : objects_) {
+            ++references[object];
+        }
+
+        std::vector<uint8_t> marks(nodes_.size(), 0);
+        for (NodeId object : objects_) {
+            markBlended(object, false, marks);
+        }
+
+        Bounds reach = Bounds{x_min, x_max, y_min, y_max}.padded(margin);
+        std::vector<std::optional<Simplified>> done(nodes_.size());
+        std::vector<NodeId> objects;
+        for (NodeId object : objects_) {
+            Simplified simplified = simplify(object, reach, references, marks, done, stats);
+            if (simplified.bounds.intersects(reach)) {
+                objects.push_back(simplified.id);
+            } else {
+                ++stats.culled;
+            }
+        }
+        objects_ = std::move(objects);
+        stats.nodes_after = order(final_ids).size();
+        return stats;
+    }
+
+    std::shared_ptr<NodeArena> buildArena(std::vector<NodeId>* roots=nullptr) const {
+        bool wide = std::any_of(nodes_.begin(), nodes_.end(), [](const Node& node) {
+            return node.node.kind == NodeKind::Intersection && node.children.size() > 2;
+        });
+        if (wide) {
+            SceneBuilder binary = *this;
+            binary.splitWideIntersections();
+            return binary.buildArena(roots);
+        }
+        std::vector<NodeId> final_ids;
+        std::vector<NodeId> sequence = order(final_ids);
+
+        auto layout = [](auto* type, auto&&...) {
+            using T = std::remove_pointer_t<decltype(type)>;
+            return Layout{sizeof(T), alignof(T)};
+        };
+        std::vector<size_t> offsets(sequence.size());
+        size_t node_bytes = 0;
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            const Node& node = nodes_[sequence[i]];
+            if (node.node.kind == NodeKind::Custom) {
+                continue;
+            }
+            Layout size = visitArenaType(node, nullptr, nullptr, layout);
+            node_bytes = (node_bytes + size.alignment - 1) / size.alignment * size.alignment;
+            offsets[i] = node_bytes;
+            node_bytes += size.size;
+        }
+
+        auto arena = std::make_shared<NodeArena>(sequence.size(), node_bytes);
+        auto* base = static_cast<std::byte*>(arena->block_) + (arena->bytes_ - node_bytes);
+        std::vector<NodeId> children;
+        for (size_t i = 0; i < sequence.size(); ++i) {
+            const Node& node = nodes_[sequence[i]];
+            if (node.node.kind == NodeKind::Custom) {
+                const auto& object = custom_[node.node.resource];
+                arena->external_.push_back(object);
+                arena->nodes_[i] = object.get();
+            } else {
+                children.clear();
+                for (NodeId child : node.children) {
+                    children.push_back(final_ids[child]);
+                }
+                void* where = base + offsets[i];
+                arena->nodes_[i] = visitArenaType(node, arena.get(), children.data(), [where](auto* type, auto&&... args) -> SDF* {
+                    using T = std::remove_pointer_t<decltype(type)>;
+                    return new (where) T(std::forward<decltype(args)>(args)...);
+                });
+            }
+            arena->constructed_ = i + 1;
+        }
+        if (roots) {
+            roots->clear();
+            for (NodeId object : objects_) {
+                roots->push_back(final_ids[object]);
+            }
+        }
+        return arena;
+    }
+
+    /// Shared subtrees are copied, so that every subtree of the result is one contiguous range
+    std::shared_ptr<FlatScene> buildFlat(std::vector<NodeId>* roots=nullptr) const {
+        auto scene = std::make_shared<FlatScene>();
+        scene->textures = textures_;
+        scene->custom = custom_;
+        std::vector<uint32_t> color_ids(colors_.size(), kUnassigned);
+        std::vector<NodeId> flat_roots;
+        FlatArrays arrays;
+        for (NodeId object : objects_) {
+            flat_roots.push_back(emitFlat(object, arrays, *scene, color_ids));
+        }
+        scene->nodes = SharedArray<FlatNode>(std::move(arrays.nodes));
+        scene->children = SharedArray<uint32_t>(std::move(arrays.children));
+        if (roots) {
+            *roots = flat_roots;
+        }
+        return scene;
+    }
+
+    Scene build(double x_min, double x_max, double y_min, double y_max, RGBColor background,
+                SceneRepresentation representation=SceneRepresentation::Arena) const {
+        std::vector<NodeId> roots;
+        std::vector<std::shared_ptr<SDF>> objects;
+        if (representation == SceneRepresentation::Flat) {
+            std::shared_ptr<const FlatScene> flat = buildFlat(&roots);
+            for (NodeId root : roots) {
+                objects.push_back(std::make_shared<FlatObject>(flat, root));
+            }
+        } else {
+            std::shared_ptr<NodeArena> arena = buildArena(&roots);
+            for (NodeId root : roots) {
+                // aliasing pointers: the scene only holds references to the arena, not to single nodes
+                objects.emplace_back(arena, arena->node(root));
+            }
+        }
+        return Scene(objects, x_min, x_max, y_min, y_max, background);
+    }
+};
+
+#endif //SDF_SCENE_BUILDER_H
@@ -0,0 +1 @@
+#include "scene_diff.h"
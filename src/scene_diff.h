@@ -0,0 +1,176 @@
+#ifndef SDF_SCENE_DIFF_H
+#define SDF_SCENE_DIFF_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "flat_scene.h"
+#include "scene.h"
+
+/// Compares two flat scenes of the same viewport and collects where they can look different:
+/// the old and the new bounds of every node that changed. Objects are matched by their common
+/// prefix and suffix, the objects in between pairwise by position, and matched nodes with equal
+/// contents are descended into, so that a changed leaf deep in a tree only costs its own boxes.
+/// A change under a smooth intersection or an overlay costs the whole node: the blend reaches past
+/// the leaf, and an overlay paints its top's color on the anti-aliased rim of its bottom.
+/// Nodes compare by contents: colors by value and textures by their pixels, not by index
+class SceneDiff {
+    const FlatScene& before_;
+    const FlatScene& after_;
+    std::map<std::pair<uint32_t, uint32_t>, bool> same_textures_;
+    std::vector<Bounds> changed_;
+
+    static bool SameRGB(RGBColor a, RGBColor b) {
+        return a.r == b.r && a.g == b.g && a.b == b.b;
+    }
+
+    static bool SameColor(const ColorRecord& a, const ColorRecord& b) {
+        return SameRGB(a.base, b.base) && SameRGB(a.gradient_to, b.gradient_to) && SameRGB(a.border, b.border) &&
+               a.has_gradient == b.has_gradient && a.has_border == b.has_border &&
+               a.frequency == b.frequency && a.thickness == b.thickness;
+    }
+
+    bool sameTexture(uint32_t a, uint32_t b) {
+        auto [entry, inserted] = same_textures_.try_emplace({a, b}, false);
+        if (inserted) {
+            const SDFTexture& x = *before_.textures[a];
+            const SDFTexture& y = *after_.textures[b];
+            entry->second = &x == &y || (x.width == y.width && x.height == y.height && x.max_side == y.max_side &&
+                                         x.border_distance == y.border_distance &&
+                                         std::memcmp(x.data.data(), y.data.data(), x.data.size()) == 0);
+        }
+        return entry->second;
+    }
+
+    /// The nodes themselves, children aside
+    bool sameNode(uint32_t a, uint32_t b) {
+        const FlatNode& x = before_.nodes[a];
+        const FlatNode& y = after_.nodes[b];
+        if (x.kind != y.kind || x.smooth != y.smooth || x.child_count != y.child_count ||
+            !std::equal(std::begin(x.params), std::end(x.params), std::begin(y.params))) {
+            return false;
+        }
+        switch (x.kind) {
+            case NodeKind::Intersection:
+            case NodeKind::Overlay:
+                return true;
+            case NodeKind::Custom:
+                return before_.custom[x.resource] == after_.custom[y.resource];
+            case NodeKind::SDFImage:
+                if (!sameTexture(x.resource, y.resource)) {
+                    return false;
+                }
+                [[fallthrough]];
+            default:
+                return SameColor(before_.colors[x.color].record(), after_.colors[y.color].record());
+        }
+    }
+
+    /// Subtrees are contiguous ranges, equal subtrees have equal nodes at the same offsets
+    bool sameSubtree(uint32_t a, uint32_t b) {
+        uint32_t size = before_.nodes[a].subtree_end - a;
+        if (after_.nodes[b].subtree_end - b != size) {
+            return false;
+        }
+        for (uint32_t k = 0; k < size; ++k) {
+            if (!sameNode(a + k, b + k)) {
+                return false;
+            }
+            const FlatNode& x = before_.nodes[a + k];
+            const FlatNode& y = after_.nodes[b + k];
+            for (uint32_t c = 0; c < x.child_count; ++c) {
+                if (before_.children[x.first_child + c] - a != after_.children[y.first_child + c] - b) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void changedBefore(uint32_t a) {
+        changed_.push_back(before_.bounds(a));
+    }
+
+    void changedAfter(uint32_t b) {
+        changed_.push_back(after_.bounds(b));
+    }
+
+    void diff(uint32_t a, uint32_t b) {
+        if (sameSubtree(a, b)) {
+            return;
+        }
+        const FlatNode& x = before_.nodes[a];
+        const FlatNode& y = after_.nodes[b];
+        if (!sameNode(a, b) || (x.kind == NodeKind::Intersection && x.smooth) || x.kind == NodeKind::Overlay) {
+            changedBefore(a);
+            changedAfter(b);
+            return;
+        }
+        for (uint32_t c = 0; c < x.child_count; ++c) {
+            diff(before_.children[x.first_child + c], after_.children[y.first_child + c]);
+        }
+    }
+public:
+    SceneDiff(const FlatScene& before, const std::vector<uint32_t>& before_objects,
+              const FlatScene& after, const std::vector<uint32_t>& after_objects):
+        before_(before), after_(after) {
+        size_t n = before_objects.size(), m = after_objects.size();
+        size_t prefix = 0, suffix = 0;
+        while (prefix < std::min(n, m) && sameSubtree(before_objects[prefix], after_objects[prefix])) {
+            ++prefix;
+        }
+        while (suffix < std::min(n, m) - prefix &&
+               sameSubtree(before_objects[n - 1 - suffix], after_objects[m - 1 - suffix])) {
+            ++suffix;
+        }
+        for (size_t k = prefix; k < std::max(n, m) - suffix; ++k) {
+            if (k < n - suffix && k < m - suffix) {
+                diff(before_objects[k], after_objects[k]);
+            } else if (k < n - suffix) {
+                changedBefore(before_objects[k]);
+            } else {
+                changedAfter(after_objects[k]);
+            }
+        }
+    }
+
+    /// Boxes around everything that changed, some may be empty
+    const std::vector<Bounds>& changed() const {
+        return changed_;
+    }
+};
+
+/// Square tiles of tile_size pixels, the ones at the right and bottom edges may be smaller, of a
+/// height x width render of view that sample a point within margin of any of boxes. Row major order
+std::vector<PixelRect> TilesCovering(const std::vector<Bounds>& boxes, double margin, const Bounds& view,
+                                     size_t height, size_t width, size_t tile_size) {
+    size_t tiles_y = (height + tile_size - 1) / tile_size, tiles_x = (width + tile_size - 1) / tile_size;
+    std::vector<bool> dirty(tiles_y * tiles_x, false);
+    for (const Bounds& box : boxes) {
+        PixelRect pixels = PixelsCovering(box.padded(margin), view, height, width);
+        if (pixels.empty()) {
+            continue;
+        }
+        for (size_t ty = pixels.row_begin / tile_size; ty <= (pixels.row_end - 1) / tile_size; ++ty) {
+            for (size_t tx = pixels.col_begin / tile_size; tx <= (pixels.col_end - 1) / tile_size; ++tx) {
+                dirty[ty * tiles_x + tx] = true;
+            }
+        }
+    }
+    std::vector<PixelRect> tiles;
+    for (size_t ty = 0; ty < tiles_y; ++ty) {
+        for (size_t tx = 0; tx < tiles_x; ++tx) {
+            if (dirty[ty * tiles_x + tx]) {
+                tiles.push_back({ty * tile_size, std::min(height, (ty + 1) * tile_size),
+                                 tx * tile_size, std::min(width, (tx + 1) * tile_size)});
+            }
+        }
+    }
+    return tiles;
+}
+
+#endif //SDF_SCENE_DIFF_H
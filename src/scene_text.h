@@ -0,0 +1,286 @@
+#ifndef SDF_SCENE_TEXT_H
+#define SDF_SCENE_TEXT_H
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "color.h"
+#include "scene_builder.h"
+
+// Text scene files, one statement per line, '#' starts a comment. Nodes go on a stack:
+//
+//   view X_MIN X_MAX Y_MIN Y_MAX          viewport, -1 1 -1 1 by default
+//   background R G B                      black by default
+//   circle X Y RADIUS COLOR               pushes a circle
+//   rect X Y WIDTH HEIGHT COLOR           pushes an axis aligned rectangle
+//   triangle X Y RADIUS COLOR             pushes an axis aligned equilateral triangle
+//   segment AX AY BX BY R G B             pushes a segment
+//   image PATH X Y SCALE COLOR            pushes an SDF image, PATH relative to the scene file
+//   intersection [smooth [SMOOTHNESS]]    pops second, then first, pushes their intersection
+//   overlay [ALPHA]                       pops bottom, then top, pushes their overlay
+//   object                                pops a node and adds it as the next object, drawn below earlier ones
+//
+// COLOR is R G B followed by any of "gradient R G B [FREQUENCY]" and "border THICKNESS R G B"
+
+/// A scene file that can't be read or parsed, what() names the file and the line
+class SceneTextError: public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/// Where a scene file's image is and its background, its nodes go to the builder
+struct SceneTextHeader {
+    double x_min = -1, x_max = 1, y_min = -1, y_max = 1;
+    RGBColor background{0, 0, 0};
+};
+
+/// Reads a scene file a chunk at a time and hands out its statements, tokens are views into the chunk
+class SceneTextReader {
+    static constexpr size_t kChunk = 1 << 20;
+
+    FILE* file_;
+    std::string path_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0, end_ = 0; // unread bytes
+    size_t line_number_ = 0;
+    std::string_view line_;      // rest of the current statement
+
+    static std::string_view split(std::string_view& text) {
+        size_t begin = 0;
+        while (begin < text.size() && (text[begin] == ' ' || text[begin] == '\t' || text[begin] == '\r')) {
+            ++begin;
+        }
+        size_t end = begin;
+        while (end < text.size() && text[end] != ' ' && text[end] != '\t' && text[end] != '\r') {
+            ++end;
+        }
+        std::string_view token = text.substr(begin, end - begin);
+        text = text.substr(end);
+        return token;
+    }
+public:
+    explicit SceneTextReader(const std::string& path): file_(std::fopen(path.c_str(), "rb")), path_(path), buffer_(kChunk) {
+        if (file_ == nullptr) {
+            throw SceneTextError("Scene file " + path + " failed to open");
+        }
+    }
+
+    SceneTextReader(const SceneTextReader&) = delete;
+    SceneTextReader& operator=(const SceneTextReader&) = delete;
+
+    ~SceneTextReader() {
+        std::fclose(file_);
+    }
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw SceneTextError(path_ + ":" + std::to_string(line_number_) + ": " + message);
+    }
+
+    /// Moves to the next line, false at the end of the file
+    bool nextLine() {
+        while (true) {
+            auto newline = static_cast<const char*>(std::memchr(buffer_.data() + begin_, '\n', end_ - begin_));
+            if (newline == nullptr && !std::feof(file_)) {
+                // keep the partial line, make room and read on
+                std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+                if (end_ == buffer_.size()) {
+                    buffer_.resize(buffer_.size() * 2);
+                }
+                end_ += std::fread(buffer_.data() + end_, 1, buffer_.size() - end_, file_);
+                if (std::ferror(file_)) {
+                    fail("read failed");
+                }
+                continue;
+            }
+            if (newline == nullptr && begin_ == end_) {
+                return false;
+            }
+            size_t line_end = newline ? size_t(newline - buffer_.data()) : end_;
+            line_ = std::string_view(buffer_.data() + begin_, line_end - begin_);
+            begin_ = newline ? line_end + 1 : end_;
+            ++line_number_;
+            if (size_t comment = line_.find('#'); comment != std::string_view::npos) {
+                line_ = line_.substr(0, comment);
+            }
+            return true;
+        }
+    }
+
+    /// Next token of the line, empty once the line is used up
+    std::string_view token() {
+        return split(line_);
+    }
+
+    /// Next token without taking it
+    std::string_view peek() const {
+        std::string_view rest = line_;
+        return split(rest);
+    }
+
+    double number() {
+        std::string_view text = token();
+        double value = 0.0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (text.empty() || error != std::errc() || end != text.data() + text.size()) {
+            fail("expected a number, got '" + std::string(text) + "'");
+        }
+        return value;
+    }
+
+    uint8_t channel() {
+        double value = number();
+        if (value < 0 || value > 255 || value != std::floor(value)) {
+            fail("color channels are integers from 0 to 255");
+        }
+        return uint8_t(value);
+    }
+
+    RGBColor rgb() {
+        uint8_t r = channel(), g = channel();
+        return {r, g, channel()};
+    }
+
+    /// R G B with the optional gradient and border
+    Color color() {
+        RGBColor base = rgb();
+        bool has_gradient = false, has_border = false;
+        RGBColor gradient_to{}, border{};
+        double frequency = 1.0, thickness = 0.1;
+        for (std::string_view word = token(); !word.empty(); word = token()) {
+            if (word == "gradient" && !has_gradient) {
+                has_gradient = true;
+                gradient_to = rgb();
+                if (!peek().empty() && peek() != "border") {
+                    frequency = number();
+                }
+            } else if (word == "border" && !has_border) {
+                has_border = true;
+                thickness = number();
+                border = rgb();
+            } else {
+                fail("unexpected '" + std::string(word) + "' in a color");
+            }
+        }
+        if (has_gradient && has_border) {
+            return Color(base, gradient_to, border, frequency, thickness);
+        } else if (has_gradient) {
+            return Color(base, gradient_to, frequency);
+        } else if (has_border) {
+            return Color(base, thickness, border);
+        }
+        return Color(base);
+    }
+
+    /// Fails unless the line is used up
+    void endOfLine() {
+        if (std::string_view rest = token(); !rest.empty()) {
+            fail("unexpected '" + std::string(rest) + "'");
+        }
+    }
+};
+
+/// Loads a text scene file into builder, see the format above. Throws SceneTextError if the file can't be
+/// read or has an error, builder then holds whatever came before the error
+SceneTextHeader LoadSceneText(const std::string& path, SceneBuilder& builder) {
+    SceneTextHeader header;
+    SceneTextReader reader(path);
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+    std::vector<NodeId> stack;
+    auto pop = [&]() {
+        if (stack.empty()) {
+            reader.fail("not enough nodes on the stack");
+        }
+        NodeId id = stack.back();
+        stack.pop_back();
+        return id;
+    };
+
+    while (reader.nextLine()) {
+        std::string_view statement = reader.token();
+        if (statement.empty()) {
+            continue;
+        } else if (statement == "circle") {
+            double x = reader.number(), y = reader.number(), radius = reader.number();
+            stack.push_back(builder.addCircle(x, y, radius, reader.color()));
+        } else if (statement == "rect") {
+            double x = reader.number(), y = reader.number(), width = reader.number(), height = reader.number();
+            stack.push_back(builder.addAxisAlignedRectangle(x, y, width, height, reader.color()));
+        } else if (statement == "triangle") {
+            double x = reader.number(), y = reader.number(), radius = reader.number();
+            stack.push_back(builder.addAxisAlignedEquilateralTriangle(x, y, radius, reader.color()));
+        } else if (statement == "segment") {
+            double a_x = reader.number(), a_y = reader.number(), b_x = reader.number(), b_y = reader.number();
+            stack.push_back(builder.addSegment(a_x, a_y, b_x, b_y, reader.rgb()));
+            reader.endOfLine();
+        } else if (statement == "image") {
+            std::string_view file = reader.token();
+            std::string texture = file.substr(0, 1) == "/" ? std::string(file) : directory + std::string(file);
+            double x = reader.number(), y = reader.number(), scale = reader.number();
+            int width, height, channels;
+            if (!stbi_info(texture.c_str(), &width, &height, &channels)) {
+                reader.fail("image '" + texture + "' failed to load");
+            }
+            stack.push_back(builder.addSDFImage(texture, x, y, scale, reader.color()));
+        } else if (statement == "intersection") {
+            bool smooth = false;
+            double smoothness = 0.125;
+            if (reader.peek() == "smooth") {
+                reader.token();
+                smooth = true;
+                if (!reader.peek().empty()) {
+                    smoothness = reader.number();
+                }
+            }
+            reader.endOfLine();
+            NodeId second = pop(), first = pop();
+            stack.push_back(builder.addIntersection(first, second, smooth, smoothness));
+        } else if (statement == "overlay") {
+            double alpha = 0.5;
+            if (!reader.peek().empty()) {
+                alpha = reader.number();
+            }
+            reader.endOfLine();
+            NodeId bottom = pop(), top = pop();
+            stack.push_back(builder.addOverlay(top, bottom, alpha));
+        } else if (statement == "object") {
+            reader.endOfLine();
+            builder.addObject(pop());
+        } else if (statement == "view") {
+            header.x_min = reader.number();
+            header.x_max = reader.number();
+            header.y_min = reader.number();
+            header.y_max = reader.number();
+            reader.endOfLine();
+        } else if (statement == "background") {
+            header.background = reader.rgb();
+            reader.endOfLine();
+        } else {
+            reader.fail("unknown statement '" + std::string(statement) + "'");
+        }
+    }
+    if (!stack.empty()) {
+        reader.fail("nodes left on the stack: " + std::to_string(stack.size()) + ", add them with object");
+    }
+    return header;
+}
+
+/// LoadSceneText for tools that stop at the first error: prints it and exits
+SceneTextHeader LoadSceneTextOrExit(const std::string& path, SceneBuilder& builder) {
+    try {
+        return LoadSceneText(path, builder);
+    } catch (const SceneTextError& error) {
+        std::cerr << error.what() << std::endl;
+        exit(1);
+    }
+}
+
+#endif //SDF_SCENE_TEXT_H
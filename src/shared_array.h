@@ -0,0 +1,52 @@
+#ifndef SDF_SHARED_ARRAY_H
+#define SDF_SHARED_ARRAY_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/// Read-only array that either owns its elements or points into memory kept alive by an owner,
+/// e.g. a mapped scene file. Readers see the same thing either way
+template <typename T>
+class SharedArray {
+    std::vector<T> own_;
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+    std::shared_ptr<const void> owner_;
+public:
+    SharedArray() = default;
+
+    explicit SharedArray(std::vector<T> values): own_(std::move(values)), data_(own_.data()), size_(own_.size()) {}
+
+    SharedArray(const T* data, size_t size, std::shared_ptr<const void> owner):
+        data_(data), size_(size), owner_(std::move(owner)) {}
+
+    // moving a vector keeps its buffer, copying would leave data_ behind
+    SharedArray(SharedArray&&) noexcept = default;
+    SharedArray& operator=(SharedArray&&) noexcept = default;
+    SharedArray(const SharedArray&) = delete;
+    SharedArray& operator=(const SharedArray&) = delete;
+
+    const T& operator[](size_t i) const {
+        return data_[i];
+    }
+
+    const T* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    const T* begin() const {
+        return data_;
+    }
+
+    const T* end() const {
+        return data_ + size_;
+    }
+};
+
+#endif //SDF_SHARED_ARRAY_H
@@ -0,0 +1 @@
+#include "shared_framebuffer.h"
@@ -0,0 +1,226 @@
+#ifndef SDF_SHARED_FRAMEBUFFER_H
+#define SDF_SHARED_FRAMEBUFFER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+
+// Ring of RGB8 framebuffers in POSIX shared memory.
+//
+// Layout of the shared object:
+//   [SharedFramebufferHeader, padded to kSharedPageSize][slot 0][slot 1]...
+// Every slot holds one frame in the AlignedImage<uint8_t, 3> layout (rows are header.pitch bytes apart).
+//
+// The writer fills a slot that is not the latest one, then marks it ready and publishes it
+// through header.latest_slot and header.frame_number. A viewer polls frame_number, copies the
+// latest slot and checks that the slot still carries the same frame number afterwards.
+
+constexpr uint32_t kSharedFramebufferMagic = 0x42464453; // "SDFB"
+constexpr uint32_t kSharedFramebufferVersion = 1;
+constexpr uint32_t kMaxSharedSlots = 8;
+constexpr size_t kSharedPageSize = 4096;
+
+struct SharedFramebufferSlot {
+    std::atomic<uint64_t> frame;  // frame number stored in the slot
+    std::atomic<uint32_t> ready;  // 0 while the writer is rendering into the slot
+    uint32_t padding;
+};
+
+struct SharedFramebufferHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width, height, channels;
+    uint32_t pitch;       // bytes between rows
+    uint32_t slot_count;
+    uint32_t padding;
+    uint64_t slot_offset; // from the beginning of the shared object
+    uint64_t slot_size;   // bytes, multiple of kSharedPageSize
+    std::atomic<uint64_t> frame_number; // last published frame, 0 if none yet
+    std::atomic<uint32_t> latest_slot;
+    uint32_t padding2;
+    SharedFramebufferSlot slots[kMaxSharedSlots];
+};
+
+static_assert(sizeof(SharedFramebufferHeader) <= kSharedPageSize, "header must fit in one page");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock free");
+
+size_t RoundUpToPage(size_t bytes) {
+    return (bytes + kSharedPageSize - 1) / kSharedPageSize * kSharedPageSize;
+}
+
+/// Writer side of the ring. Reopening an existing ring with the same dimensions
+/// keeps counting frames, so a viewer keeps working across runs of the renderer
+class SharedFramebuffer {
+    std::string name_;
+    size_t mapped_size_ = 0;
+    SharedFramebufferHeader* header_ = nullptr;
+    uint32_t writing_slot_ = 0;
+
+    uint8_t* slotData(uint32_t slot) {
+        return reinterpret_cast<uint8_t*>(header_) + header_->slot_offset + slot * header_->slot_size;
+    }
+public:
+    SharedFramebuffer(const std::string& name, size_t height, size_t width, uint32_t slot_count=3): name_(name) {
+        if (slot_count < 2 || slot_count > kMaxSharedSlots) {
+            std::cerr << "Shared framebuffer needs between 2 and " << kMaxSharedSlots << " slots" << std::endl;
+            exit(1);
+        }
+        int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0) {
+            std::cerr << "Failed to open shared memory " << name_ << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        size_t pitch = AlignedImage<uint8_t, 3>::RequiredBytes(1, width);
+        size_t slot_size = RoundUpToPage(AlignedImage<uint8_t, 3>::RequiredBytes(height, width));
+        mapped_size_ = kSharedPageSize + slot_size * slot_count;
+
+        struct stat info{};
+        fstat(fd, &info);
+        bool fresh = size_t(info.st_size) != mapped_size_;
+        if (fresh && ftruncate(fd, mapped_size_) != 0) {
+            std::cerr << "Failed to resize shared memory " << name_ << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        void* memory = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Failed to map shared memory " << name_ << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        header_ = static_cast<SharedFramebufferHeader*>(memory);
+
+        fresh = fresh || header_->magic != kSharedFramebufferMagic || header_->version != kSharedFramebufferVersion ||
+                header_->width != width || header_->height != height || header_->slot_count != slot_count;
+        if (fresh) {
+            header_->magic = 0; // readers ignore the ring until the header is complete
+            std::atomic_thread_fence(std::memory_order_release);
+            header_->version = kSharedFramebufferVersion;
+            header_->width = width;
+            header_->height = height;
+            header_->channels = 3;
+            header_->pitch = pitch;
+            header_->slot_count = slot_count;
+            header_->slot_offset = kSharedPageSize;
+            header_->slot_size = slot_size;
+            header_->frame_number.store(0);
+            header_->latest_slot.store(0);
+            for (auto& slot : header_->slots) {
+                slot.frame.store(0);
+                slot.ready.store(0);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            header_->magic = kSharedFramebufferMagic;
+        }
+    }
+
+    SharedFramebuffer(const SharedFramebuffer&) = delete;
+    SharedFramebuffer& operator=(const SharedFramebuffer&) = delete;
+
+    ~SharedFramebuffer() {
+        munmap(header_, mapped_size_);
+    }
+
+    /// Image view of the next free slot. Render into it and call Publish()
+    AlignedImage<uint8_t, 3> BeginFrame() {
+        uint32_t latest = header_->latest_slot.load(std::memory_order_acquire);
+        writing_slot_ = (latest + 1) % header_->slot_count;
+        header_->slots[writing_slot_].ready.store(0, std::memory_order_release);
+        return AlignedImage<uint8_t, 3>(header_->height, header_->width, slotData(writing_slot_));
+    }
+
+    /// Makes the slot from the last BeginFrame() the latest frame, returns its number
+    uint64_t Publish() {
+        uint64_t frame = header_->frame_number.load(std::memory_order_relaxed) + 1;
+        auto& slot = header_->slots[writing_slot_];
+        slot.frame.store(frame, std::memory_order_relaxed);
+        slot.ready.store(1, std::memory_order_release);
+        header_->latest_slot.store(writing_slot_, std::memory_order_release);
+        header_->frame_number.store(frame, std::memory_order_release);
+        return frame;
+    }
+
+    /// Removes the name, mappings that are already open stay valid
+    void Unlink() {
+        shm_unlink(name_.c_str());
+    }
+};
+
+/// Viewer side of the ring
+class SharedFramebufferReader {
+    size_t mapped_size_ = 0;
+    const SharedFramebufferHeader* header_ = nullptr;
+public:
+    explicit SharedFramebufferReader(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info{};
+        fstat(fd, &info);
+        mapped_size_ = info.st_size;
+        void* memory = mapped_size_ >= kSharedPageSize ?
+                mmap(nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (memory != MAP_FAILED) {
+            header_ = static_cast<const SharedFramebufferHeader*>(memory);
+        }
+    }
+
+    SharedFramebufferReader(const SharedFramebufferReader&) = delete;
+    SharedFramebufferReader& operator=(const SharedFramebufferReader&) = delete;
+
+    ~SharedFramebufferReader() {
+        if (header_) {
+            munmap(const_cast<SharedFramebufferHeader*>(header_), mapped_size_);
+        }
+    }
+
+    bool valid() const {
+        return header_ && header_->magic == kSharedFramebufferMagic && header_->version == kSharedFramebufferVersion &&
+               header_->slot_offset + header_->slot_size * header_->slot_count <= mapped_size_;
+    }
+
+    const SharedFramebufferHeader* header() const { return header_; }
+
+    uint64_t latestFrame() const {
+        return valid() ? header_->frame_number.load(std::memory_order_acquire) : 0;
+    }
+
+    /// Copies the latest frame (height * pitch bytes) to out if it is newer than after_frame.
+    /// Returns the copied frame number, or 0 if there was nothing new or the writer overtook the copy
+    uint64_t CopyLatest(uint8_t* out, uint64_t after_frame=0) const {
+        if (!valid()) {
+            return 0;
+        }
+        uint64_t frame = header_->frame_number.load(std::memory_order_acquire);
+        if (frame == 0 || frame <= after_frame) {
+            return 0;
+        }
+        uint32_t slot_index = header_->latest_slot.load(std::memory_order_acquire);
+        const auto& slot = header_->slots[slot_index];
+        if (!slot.ready.load(std::memory_order_acquire) || slot.frame.load(std::memory_order_acquire) != frame) {
+            return 0;
+        }
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(header_) + header_->slot_offset +
+                              slot_index * header_->slot_size;
+        std::memcpy(out, data, size_t(header_->height) * header_->pitch);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!slot.ready.load(std::memory_order_relaxed) || slot.frame.load(std::memory_order_relaxed) != frame) {
+            return 0;
+        }
+        return frame;
+    }
+};
+
+#endif //SDF_SHARED_FRAMEBUFFER_H
@@ -0,0 +1,389 @@
+#ifndef SDF_STATIC_SCENE_H
+#define SDF_STATIC_SCENE_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "distance_functions.h"
+#include "scene.h"
+
+// Scene graphs whose structure is a type, e.g. StaticOverlay<StaticCircle<FlatColor>, StaticCircle<FlatColor>>.
+// Nothing here is virtual: the distance function of a whole StaticScene inlines into one render kernel,
+// and the compiler folds every parameter it can see. Meant for fixed assets like logos and icons.
+// Primitives take one of the shading variants from color.h, class template argument deduction
+// picks the types, so a scene reads like its runtime counterpart
+
+/// Shading of the static primitives, Derived provides distance() and shadingArg()
+template <typename Derived, typename ColorT>
+class StaticPrimitive {
+protected:
+    ColorT color_;
+
+    explicit StaticPrimitive(ColorT color): color_(std::move(color)) {}
+private:
+    const Derived& self() const {
+        return static_cast<const Derived&>(*this);
+    }
+public:
+    RGBColor getColor(double x, double y) const {
+        return color_.getColor(ColorT::kUsesDistance ? self().distance(x, y) : 0.0, self().shadingArg(x, y));
+    }
+
+    LinearColor getLinearColor(double x, double y) const {
+        return color_.getLinearColor(ColorT::kUsesDistance ? self().distance(x, y) : 0.0, self().shadingArg(x, y));
+    }
+
+    double edgeDistance(double x, double y, double eps) const {
+        return color_.edgeDistance(self().distance(x, y), eps);
+    }
+};
+
+template <typename ColorT>
+class StaticCircle: public StaticPrimitive<StaticCircle<ColorT>, ColorT> {
+    double x_, y_;
+    double radius_;
+public:
+    StaticCircle(double x, double y, double radius, ColorT color):
+        StaticPrimitive<StaticCircle<ColorT>, ColorT>(std::move(color)), x_(x), y_(y), radius_(radius) {}
+
+    double distance(double x, double y) const {
+        return CircleDistance(x, y, x_, y_, radius_);
+    }
+
+    Bounds bounds() const {
+        return CircleBounds(x_, y_, radius_);
+    }
+
+    double shadingArg(double x, double y) const {
+        return x - x_ - radius_;
+    }
+};
+
+template <typename ColorT>
+class StaticAxisAlignedRectangle: public StaticPrimitive<StaticAxisAlignedRectangle<ColorT>, ColorT> {
+    double x_, y_;
+    double width_, height_;
+public:
+    StaticAxisAlignedRectangle(double x, double y, double width, double height, ColorT color):
+        StaticPrimitive<StaticAxisAlignedRectangle<ColorT>, ColorT>(std::move(color)),
+        x_(x),
+        y_(y),
+        width_(width),
+        height_(height)
+    {}
+
+    double distance(double x, double y) const {
+        return AxisAlignedRectangleDistance(x, y, x_, y_, width_, height_);
+    }
+
+    Bounds bounds() const {
+        return AxisAlignedRectangleBounds(x_, y_, width_, height_);
+    }
+
+    double shadingArg(double x, double y) const {
+        return y - y_ - height_;
+    }
+};
+
+class StaticSegment: public StaticPrimitive<StaticSegment, FlatColor> {
+    double a_x_, a_y_, b_x_, b_y_;
+public:
+    StaticSegment(double a_x, double a_y, double b_x, double b_y, RGBColor color):
+        StaticPrimitive<StaticSegment, FlatColor>(FlatColor{color}),
+        a_x_(a_x),
+        a_y_(a_y),
+        b_x_(b_x),
+        b_y_(b_y)
+    {}
+
+    double distance(double x, double y) const {
+        return SegmentDistance(x, y, a_x_, a_y_, b_x_, b_y_);
+    }
+
+    Bounds bounds() const {
+        return SegmentBounds(a_x_, a_y_, b_x_, b_y_);
+    }
+
+    double shadingArg(double, double) const {
+        return 0.0;
+    }
+};
+
+template <typename ColorT>
+class StaticAxisAlignedEquilateralTriangle: public StaticPrimitive<StaticAxisAlignedEquilateralTriangle<ColorT>, ColorT> {
+    double x_, y_;
+    double radius_;
+public:
+    StaticAxisAlignedEquilateralTriangle(double x, double y, double radius, ColorT color):
+        StaticPrimitive<StaticAxisAlignedEquilateralTriangle<ColorT>, ColorT>(std::move(color)),
+        x_(x),
+        y_(y),
+        radius_(radius * 2 / std::sqrt(3))
+    {}
+
+    double distance(double x, double y) const {
+        return AxisAlignedEquilateralTriangleDistance(x, y, x_, y_, radius_);
+    }
+
+    Bounds bounds() const {
+        return AxisAlignedEquilateralTriangleBounds(x_, y_, radius_);
+    }
+
+    double shadingArg(double x, double y) const {
+        return y - y_ - radius_;
+    }
+};
+
+template <typename ColorT>
+class StaticSDFImage: public StaticPrimitive<StaticSDFImage<ColorT>, ColorT> {
+    double x_, y_;
+    double scale_;
+    std::shared_ptr<const SDFTexture> texture_;
+public:
+    StaticSDFImage(std::shared_ptr<const SDFTexture> texture, double x, double y, double scale, ColorT color):
+        StaticPrimitive<StaticSDFImage<ColorT>, ColorT>(std::move(color)),
+        x_(x - scale * texture->width / texture->max_side / 2),
+        y_(y - scale * texture->height / texture->max_side / 2),
+        scale_(scale),
+        texture_(std::move(texture))
+    {}
+
+    double distance(double x, double y) const {
+        return texture_->distance(x - x_, y - y_, scale_);
+    }
+
+    Bounds bounds() const {
+        return texture_->bounds(x_, y_, scale_);
+    }
+
+    double shadingArg(double x, double y) const {
+        return y - y_ - scale_;
+    }
+};
+
+template <typename First, typename Second>
+class StaticIntersection {
+    First first_;
+    Second second_;
+public:
+    StaticIntersection(First first, Second second): first_(std::move(first)), second_(std::move(second)) {}
+
+    double distance(double x, double y) const {
+        return std::min(first_.distance(x, y), second_.distance(x, y));
+    }
+
+    RGBColor getColor(double x, double y) const {
+        return first_.distance(x, y) < second_.distance(x, y) ? first_.getColor(x, y) : second_.getColor(x, y);
+    }
+
+    LinearColor getLinearColor(double x, double y) const {
+        return first_.distance(x, y) < second_.distance(x, y) ? first_.getLinearColor(x, y) : second_.getLinearColor(x, y);
+    }
+
+    double edgeDistance(double x, double y, double eps) const {
+        return std::min(first_.edgeDistance(x, y, eps), second_.edgeDistance(x, y, eps));
+    }
+
+    Bounds bounds() const {
+        return first_.bounds().united(second_.bounds());
+    }
+};
+
+template <typename First, typename Second>
+class StaticSmoothIntersection {
+    First first_;
+    Second second_;
+    double smoothness_;
+public:
+    StaticSmoothIntersection(First first, Second second, double smoothness=0.125):
+        first_(std::move(first)), second_(std::move(second)), smoothness_(smoothness) {}
+
+    double distance(double x, double y) const {
+        return sminCubic(first_.distance(x, y), second_.distance(x, y), smoothness_);
+    }
+
+    RGBColor getColor(double x, double y) const {
+        double blend = sminCubicCol(second_.distance(x, y), first_.distance(x, y), smoothness_);
+        return MixColors(first_.getColor(x, y), second_.getColor(x, y), blend);
+    }
+
+    LinearColor getLinearColor(double x, double y) const {
+        double blend = sminCubicCol(second_.distance(x, y), first_.distance(x, y), smoothness_);
+        return MixLinear(first_.getLinearColor(x, y), second_.getLinearColor(x, y), blend);
+    }
+
+    double edgeDistance(double x, double y, double eps) const {
+        double children = std::min(first_.edgeDistance(x, y, eps), second_.edgeDistance(x, y, eps));
+        return std::min(std::abs(distance(x, y) - eps), children);
+    }
+
+    Bounds bounds() const {
+        return first_.bounds().united(second_.bounds()).padded(SmoothBlendPadding(smoothness_));
+    }
+};
+
+template <typename Top, typename Bottom>
+class StaticOverlay {
+    Top top_;
+    Bottom bottom_;
+    double alpha_;
+public:
+    StaticOverlay(Top top, Bottom bottom, double alpha=0.5): top_(std::move(top)), bottom_(std::move(bottom)), alpha_(alpha) {}
+
+    double distance(double x, double y) const {
+        return std::min(top_.distance(x, y), bottom_.distance(x, y));
+    }
+
+    RGBColor getColor(double x, double y) const {
+        bool top_inside = top_.distance(x, y) < kOverlayEps;
+        bool bottom_inside = bottom_.distance(x, y) < kOverlayEps;
+        if (top_inside && bottom_inside) {
+            return MixColors(top_.getColor(x, y), bottom_.getColor(x, y), alpha_);
+        } else if (bottom_inside) {
+            return bottom_.getColor(x, y);
+        } else {
+            return top_.getColor(x, y);
+        }
+    }
+
+    LinearColor getLinearColor(double x, double y) const {
+        bool top_inside = top_.distance(x, y) < kOverlayEps;
+        bool bottom_inside = bottom_.distance(x, y) < kOverlayEps;
+        if (top_inside && bottom_inside) {
+            return MixLinear(top_.getLinearColor(x, y), bottom_.getLinearColor(x, y), alpha_);
+        } else if (bottom_inside) {
+            return bottom_.getLinearColor(x, y);
+        } else {
+            return top_.getLinearColor(x, y);
+        }
+    }
+
+    double edgeDistance(double x, double y, double eps) const {
+        return std::min(top_.edgeDistance(x, y, eps), bottom_.edgeDistance(x, y, eps));
+    }
+
+    Bounds bounds() const {
+        return top_.bounds().united(bottom_.bounds());
+    }
+};
+
+/// A static graph behind the SDF interface, one virtual call for the whole subtree
+template <typename Node>
+class StaticObject final: public SDF {
+    Node node_;
+public:
+    explicit StaticObject(Node node): node_(std::move(node)) {}
+
+    double distance(double x, double y) override {
+        return node_.distance(x, y);
+    }
+
+    RGBColor getColor(double x, double y) override {
+        return node_.getColor(x, y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        return node_.getLinearColor(x, y);
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        return node_.edgeDistance(x, y, eps);
+    }
+
+    Bounds bounds() const override {
+        return node_.bounds();
+    }
+};
+
+/// Scene with a static graph per object. RenderToImage is a kernel specialized on the whole scene,
+/// the other render modes go through ToScene()
+template <typename... Objects>
+class StaticScene {
+    std::tuple<Objects...> objects_;
+    double x_min_, x_max_, y_min_, y_max_;
+    RGBColor background_;
+public:
+    StaticScene(double x_min, double x_max, double y_min, double y_max, RGBColor background, Objects... objects):
+        objects_(std::move(objects)...),
+        x_min_(x_min),
+        x_max_(x_max),
+        y_min_(y_min),
+        y_max_(y_max),
+        background_(background)
+    {}
+
+    /// Same rule as Scene::ShadePixel, the object loop is unrolled at compile time
+    RGBColor ShadePixel(double x, double y, double eps) const {
+        RGBColor color = background_;
+        std::apply([&](const auto&... object) {
+            // || stops at the first object that is hit
+            (void)(... || (object.distance(x, y) < eps && (color = object.getColor(x, y), true)));
+        }, objects_);
+        return color;
+    }
+
+    LinearColor ShadeLinearPixel(double x, double y, double eps) const {
+        LinearColor color = ToLinear(background_);
+        std::apply([&](const auto&... object) {
+            (void)(... || (object.distance(x, y) < eps && (color = object.getLinearColor(x, y), true)));
+        }, objects_);
+        return color;
+    }
+
+    template<typename pixel_type, size_t channels>
+    void RenderToImage(AlignedImage<pixel_type, channels>& image, double eps=1e-3) const {
+        static_assert(channels == 3 || channels == 4, "only RGB and RGBA images are supported");
+        if constexpr (std::is_same_v<pixel_type, float>) {
+            std::vector<LinearColor> row_colors(image.width_);
+            for (size_t i = 0; i < image.height_; ++i) {
+                double y = y_min_ + double(i) / image.height_ * (y_max_ - y_min_);
+                for (size_t j = 0; j < image.width_; ++j) {
+                    double x = x_min_ + double(j) / image.width_ * (x_max_ - x_min_);
+                    row_colors[j] = ShadeLinearPixel(x, y, eps);
+                }
+                Scene::StoreLinearRow<pixel_type, channels>(row_colors.data(), image.row(i), image.width_);
+            }
+        } else {
+            std::vector<RGBColor> row_colors(image.width_);
+            for (size_t i = 0; i < image.height_; ++i) {
+                double y = y_min_ + double(i) / image.height_ * (y_max_ - y_min_);
+                for (size_t j = 0; j < image.width_; ++j) {
+                    double x = x_min_ + double(j) / image.width_ * (x_max_ - x_min_);
+                    row_colors[j] = ShadePixel(x, y, eps);
+                }
+                Scene::StoreRow<pixel_type, channels>(row_colors.data(), image.row(i), image.width_);
+            }
+        }
+    }
+
+    template<typename pixel_type, size_t channels>
+    void RenderToImageAntialiased(AlignedImage<pixel_type, channels>& image, double eps=1e-3) const {
+        ToScene().RenderToImageAntialiased(image, eps);
+    }
+
+    template<typename pixel_type, size_t channels>
+    size_t RenderToImageAdaptive(AlignedImage<pixel_type, channels>& image, double eps=1e-3,
+                                 const AdaptiveSamplingOptions& options=AdaptiveSamplingOptions()) const {
+        return ToScene().RenderToImageAdaptive(image, eps, options);
+    }
+
+    template<typename pixel_type, size_t channels>
+    void RenderToImageDeferred(AlignedImage<pixel_type, channels>& image, double eps=1e-3) const {
+        ToScene().RenderToImageDeferred(image, eps);
+    }
+
+    /// The same scene with every object as a StaticObject
+    Scene ToScene() const {
+        std::vector<std::shared_ptr<SDF>> objects;
+        std::apply([&](const auto&... object) {
+            (objects.push_back(std::make_shared<StaticObject<std::decay_t<decltype(object)>>>(object)), ...);
+        }, objects_);
+        return Scene(objects, x_min_, x_max_, y_min_, y_max_, background_);
+    }
+};
+
+#endif //SDF_STATIC_SCENE_H
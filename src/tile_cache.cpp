@@ -0,0 +1 @@
+#include "tile_cache.h"
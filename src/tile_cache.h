@@ -0,0 +1,321 @@
+#ifndef SDF_TILE_CACHE_H
+#define SDF_TILE_CACHE_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_scene.h"
+#include "image.h"
+#include "parallel.h"
+#include "scene.h"
+
+/// Goes into every tile key, bump it whenever a change to the renderers changes their pixels
+constexpr uint32_t kTileCacheVersion = 2;
+constexpr uint32_t kTileFileMagic = 0x43544453; // "SDTC"
+
+/// 128 bit key of a tile, two independent 64 bit mixes over the same words
+class TileHasher {
+    uint64_t low_ = 0x9e3779b97f4a7c15ull, high_ = 0xc2b2ae3d27d4eb4full;
+
+    static uint64_t Mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+public:
+    void add(uint64_t value) {
+        low_ = Mix(low_ ^ value);
+        high_ = Mix(high_ + value * 0xff51afd7ed558ccdull);
+    }
+
+    void add(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        add(bits);
+    }
+
+    void add(RGBColor color) {
+        add(uint64_t(color.r) | uint64_t(color.g) << 8 | uint64_t(color.b) << 16);
+    }
+
+    void add(const void* data, size_t size) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        add(uint64_t(size));
+        for (size_t i = 0; i < size; i += 8) {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + i, std::min<size_t>(8, size - i));
+            add(word);
+        }
+    }
+
+    void add(const TileHasher& other) {
+        add(other.low_);
+        add(other.high_);
+    }
+
+    /// 32 hex digits
+    std::string hex() const {
+        char text[33];
+        std::snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)high_, (unsigned long long)low_);
+        return text;
+    }
+};
+
+struct TileCacheStats {
+    size_t tiles = 0;
+    size_t reused = 0;      // read from the cache
+    size_t uncacheable = 0; // reached by nodes that can't be hashed, rendered every time
+};
+
+/// Rendered tiles on disk, one file per tile named after a hash of everything that decides its pixels:
+/// the cache version, the renderer, the viewport, the image size, the tile's place in the image, the background
+/// and, front to back, the nodes that reach the tile. Nodes are pruned per tile: objects and children of
+/// plain intersections whose bounds stay margin away from the tile's samples are left out, they can't change
+/// a pixel there. Under a smooth intersection everything counts, the blend reaches further, and so it does
+/// under an overlay, which paints its top's color on the anti-aliased rim of its bottom however far apart.
+/// So an edit to one shape only changes the keys of the tiles around it and a scene rendered again, by this
+/// process or any other sharing the directory, reads the other tiles back instead of rendering them.
+/// Only scenes of FlatObjects are hashed; tiles reached by anything else are rendered and never stored.
+/// Files appear through a rename, so processes sharing a directory never read a half written tile
+class TileCache {
+    std::string directory_;
+
+    /// What the nodes of one FlatScene hash to, built once per scene and shared by all tiles
+    struct SceneHashes {
+        std::vector<Bounds> bounds;
+        std::vector<TileHasher> textures;
+    };
+
+    /// An object as the tiles see it. Objects that can't be pruned are hashed once, whole
+    struct ObjectEntry {
+        Bounds bounds;
+        TileHasher whole;
+        const FlatObject* flat = nullptr;
+        const SceneHashes* hashes = nullptr;
+        bool pruned = false;   // root is a plain intersection, hashed per tile
+        bool cacheable = true;
+    };
+
+    std::string path(const TileHasher& key) const {
+        return directory_ + "/" + key.hex() + ".tile";
+    }
+
+    /// Adds the subtree's nodes that can reach box, false if it holds a node that can't be hashed
+    static bool AddSubtree(TileHasher& key, const FlatScene& scene, const SceneHashes& hashes, uint32_t id,
+                           const Bounds& box, bool whole) {
+        const FlatNode& node = scene.nodes[id];
+        key.add(uint64_t(node.kind) | uint64_t(node.smooth) << 8);
+        for (double param : node.params) {
+            key.add(param);
+        }
+        switch (node.kind) {
+            case NodeKind::Custom:
+                return false;
+            case NodeKind::Intersection:
+            case NodeKind::Overlay: {
+                whole = whole || node.kind == NodeKind::Overlay || (node.kind == NodeKind::Intersection && node.smooth);
+                key.add(uint64_t(node.child_count));
+                for (uint32_t k = 0; k < node.child_count; ++k) {
+                    uint32_t child = scene.children[node.first_child + k];
+                    if (!whole && !hashes.bounds[child].intersects(box)) {
+                        continue;
+                    }
+                    key.add(uint64_t(k));
+                    if (!AddSubtree(key, scene, hashes, child, box, whole)) {
+                        return false;
+                    }
+                }
+                key.add(~uint64_t(0)); // end of the children
+                return true;
+            }
+            case NodeKind::SDFImage:
+                key.add(hashes.textures[node.resource]);
+                [[fallthrough]];
+            default: {
+                ColorRecord color = scene.colors[node.color].record();
+                key.add(color.base);
+                key.add(color.gradient_to);
+                key.add(color.border);
+                key.add(uint64_t(color.has_gradient) | uint64_t(color.has_border) << 8);
+                key.add(color.frequency);
+                key.add(color.thickness);
+                return true;
+            }
+        }
+    }
+
+    bool load(const TileHasher& key, AlignedImage<uint8_t, 3>& image, const PixelRect& tile) const {
+        FILE* file = std::fopen(path(key).c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        size_t width = tile.col_end - tile.col_begin, height = tile.row_end - tile.row_begin;
+        uint32_t header[4] = {};
+        bool read = std::fread(header, sizeof(header), 1, file) == 1 && header[0] == kTileFileMagic &&
+                    header[1] == width && header[2] == height && header[3] == 3;
+        for (size_t i = 0; read && i < height; ++i) {
+            read = std::fread(image.row(tile.row_begin + i) + tile.col_begin * 3, 1, width * 3, file) == width * 3;
+        }
+        std::fclose(file);
+        return read;
+    }
+
+    void store(const TileHasher& key, const AlignedImage<uint8_t, 3>& image, const PixelRect& tile) const {
+        std::string final_path = path(key);
+        std::string temporary = final_path + "." + std::to_string(getpid()) + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Failed to open " << temporary << " for writing" << std::endl;
+            return;
+        }
+        size_t width = tile.col_end - tile.col_begin, height = tile.row_end - tile.row_begin;
+        const uint32_t header[4] = {kTileFileMagic, uint32_t(width), uint32_t(height), 3};
+        std::fwrite(header, sizeof(header), 1, file);
+        for (size_t i = 0; i < height; ++i) {
+            std::fwrite(image.row(tile.row_begin + i) + tile.col_begin * 3, 1, width * 3, file);
+        }
+        bool written = !std::ferror(file);
+        if (std::fclose(file) != 0 || !written || std::rename(temporary.c_str(), final_path.c_str()) != 0) {
+            std::cerr << "Failed to write " << final_path << std::endl;
+            std::remove(temporary.c_str());
+        }
+    }
+public:
+    static constexpr size_t kTileSize = 64;
+
+    /// Creates the directory if it isn't there
+    explicit TileCache(std::string directory): directory_(std::move(directory)) {
+        if (mkdir(directory_.c_str(), 0777) != 0 && errno != EEXIST) {
+            std::cerr << "Tile cache " << directory_ << " failed to create: " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+    }
+
+    /// Fills image tile by tile: tiles found in the cache are read back, the others go through
+    /// render_tile(tile) and are stored. renderer names the render mode and its settings, margin is how
+    /// far from a sample the renderer looks: eps plus the pixels its anti-aliasing reaches
+    template<typename RenderTile>
+    TileCacheStats render(const Scene& scene, AlignedImage<uint8_t, 3>& image, const std::string& renderer,
+                          double margin, RenderTile&& render_tile) const {
+        const size_t height = image.height_, width = image.width_;
+        const Bounds view = scene.view();
+        TileHasher base;
+        base.add(uint64_t(kTileCacheVersion));
+        base.add(renderer.data(), renderer.size());
+        base.add(view.x_min);
+        base.add(view.x_max);
+        base.add(view.y_min);
+        base.add(view.y_max);
+        base.add(uint64_t(height) << 32 | width);
+        base.add(scene.background());
+
+        // everything about the objects that doesn't depend on the tile, in one pass, so that the
+        // tiles read one record per object. FlatObjects of one scene share the scene's hashes
+        const auto& objects = scene.objects();
+        std::map<const FlatScene*, SceneHashes> scene_hashes;
+        std::vector<ObjectEntry> entries(objects.size());
+        for (size_t k = 0; k < objects.size(); ++k) {
+            ObjectEntry& object = entries[k];
+            object.flat = dynamic_cast<const FlatObject*>(objects[k].get());
+            if (object.flat == nullptr) {
+                object.bounds = objects[k]->bounds();
+                object.cacheable = false;
+                continue;
+            }
+            const FlatScene& flat = object.flat->scene();
+            auto [entry, inserted] = scene_hashes.try_emplace(&flat);
+            if (inserted) {
+                entry->second.bounds = flat.allBounds();
+                for (const auto& texture : flat.textures) {
+                    TileHasher pixels;
+                    pixels.add(uint64_t(texture->width) << 32 | uint32_t(texture->height));
+                    pixels.add(uint64_t(texture->max_side));
+                    pixels.add(texture->border_distance);
+                    pixels.add(texture->data.data(), texture->data.size());
+                    entry->second.textures.push_back(pixels);
+                }
+            }
+            object.hashes = &entry->second;
+            object.bounds = entry->second.bounds[object.flat->root()];
+            const FlatNode& root = flat.nodes[object.flat->root()];
+            object.pruned = root.kind == NodeKind::Intersection && !root.smooth;
+            if (!object.pruned) {
+                object.cacheable = AddSubtree(object.whole, flat, entry->second, object.flat->root(), object.bounds, true);
+            }
+        }
+
+        // objects binned by the tiles they may reach, front to back in every bin
+        size_t tiles_x = (width + kTileSize - 1) / kTileSize;
+        std::vector<PixelRect> tiles;
+        for (size_t row = 0; row < height; row += kTileSize) {
+            for (size_t col = 0; col < width; col += kTileSize) {
+                tiles.push_back({row, std::min(height, row + kTileSize), col, std::min(width, col + kTileSize)});
+            }
+        }
+        std::vector<std::vector<uint32_t>> reaching(tiles.size());
+        for (size_t k = 0; k < objects.size(); ++k) {
+            PixelRect pixels = PixelsCovering(entries[k].bounds.padded(margin), view, height, width);
+            if (pixels.empty()) {
+                continue;
+            }
+            for (size_t ty = pixels.row_begin / kTileSize; ty <= (pixels.row_end - 1) / kTileSize; ++ty) {
+                for (size_t tx = pixels.col_begin / kTileSize; tx <= (pixels.col_end - 1) / kTileSize; ++tx) {
+                    reaching[ty * tiles_x + tx].push_back(uint32_t(k));
+                }
+            }
+        }
+        std::atomic<size_t> reused{0}, uncacheable{0};
+        ParallelFor(tiles.size(), [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; ++t) {
+                const PixelRect& tile = tiles[t];
+                // the samples of the tile, grown by how far the renderer looks around them
+                Bounds box = Bounds{view.x_min + double(tile.col_begin) / width * (view.x_max - view.x_min),
+                                    view.x_min + double(tile.col_end - 1) / width * (view.x_max - view.x_min),
+                                    view.y_min + double(tile.row_begin) / height * (view.y_max - view.y_min),
+                                    view.y_min + double(tile.row_end - 1) / height * (view.y_max - view.y_min)}
+                             .padded(margin);
+                TileHasher key = base;
+                key.add(uint64_t(tile.row_begin) << 32 | tile.col_begin);
+                bool cacheable = true;
+                for (size_t i = 0; i < reaching[t].size() && cacheable; ++i) {
+                    const ObjectEntry& object = entries[reaching[t][i]];
+                    if (!object.bounds.intersects(box)) {
+                        continue;
+                    }
+                    if (!object.pruned) {
+                        cacheable = object.cacheable;
+                        key.add(object.whole);
+                    } else {
+                        cacheable = AddSubtree(key, object.flat->scene(), *object.hashes, object.flat->root(), box, false);
+                    }
+                    key.add(~uint64_t(0)); // end of the object
+                }
+                if (!cacheable) {
+                    ++uncacheable;
+                    render_tile(tile);
+                } else if (load(key, image, tile)) {
+                    ++reused;
+                } else {
+                    render_tile(tile);
+                    store(key, image, tile);
+                }
+            }
+        });
+        return {tiles.size(), reused.load(), uncacheable.load()};
+    }
+};
+
+#endif //SDF_TILE_CACHE_H
@@ -0,0 +1 @@
+#include "transform.h"
@@ -0,0 +1,141 @@
+#ifndef SDF_TRANSFORM_H
+#define SDF_TRANSFORM_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "distance_functions.h"
+
+/// 2x3 matrix of the map (x, y) -> (xx * x + xy * y + dx, yx * x + yy * y + dy)
+struct Affine {
+    double xx = 1.0, xy = 0.0, dx = 0.0;
+    double yx = 0.0, yy = 1.0, dy = 0.0;
+
+    static Affine Translation(double x, double y) {
+        return {1.0, 0.0, x, 0.0, 1.0, y};
+    }
+
+    /// Counterclockwise by angle radians around the origin
+    static Affine Rotation(double angle) {
+        double cos = std::cos(angle), sin = std::sin(angle);
+        return {cos, -sin, 0.0, sin, cos, 0.0};
+    }
+
+    static Affine Scaling(double x, double y) {
+        return {x, 0.0, 0.0, 0.0, y, 0.0};
+    }
+
+    /// Apply other first, then this
+    Affine after(const Affine& other) const {
+        return {xx * other.xx + xy * other.yx, xx * other.xy + xy * other.yy, xx * other.dx + xy * other.dy + dx,
+                yx * other.xx + yy * other.yx, yx * other.xy + yy * other.yy, yx * other.dx + yy * other.dy + dy};
+    }
+
+    double determinant() const {
+        return xx * yy - xy * yx;
+    }
+
+    Affine inverse() const {
+        double det = determinant();
+        double ixx = yy / det, ixy = -xy / det, iyx = -yx / det, iyy = xx / det;
+        return {ixx, ixy, -(ixx * dx + ixy * dy), iyx, iyy, -(iyx * dx + iyy * dy)};
+    }
+
+    /// Least factor the map stretches a length by, its smallest singular value
+    double minStretch() const {
+        // exact zero spread for rotations and uniform scaling, unlike going through the eigenvalues
+        return (std::hypot(xx + yy, yx - xy) - std::hypot(xx - yy, xy + yx)) / 2;
+    }
+
+    /// Whether the map keeps shapes, only scaling lengths uniformly
+    bool isSimilarity() const {
+        return xx == yy && xy == -yx;
+    }
+
+    void apply(double x, double y, double& out_x, double& out_y) const {
+        out_x = xx * x + xy * y + dx;
+        out_y = yx * x + yy * y + dy;
+    }
+};
+
+/// Box around a box mapped by transform
+Bounds TransformedBounds(const Bounds& box, const Affine& transform) {
+    if (box.empty()) {
+        return box;
+    }
+    if (!std::isfinite(box.x_min) || !std::isfinite(box.x_max) ||
+        !std::isfinite(box.y_min) || !std::isfinite(box.y_max)) {
+        return Bounds::Everything();
+    }
+    Bounds result = Bounds::Empty();
+    for (double corner_x : {box.x_min, box.x_max}) {
+        for (double corner_y : {box.y_min, box.y_max}) {
+            double x, y;
+            transform.apply(corner_x, corner_y, x, y);
+            result = result.united({x, x, y, y});
+        }
+    }
+    return result;
+}
+
+/// The child mapped by an affine transform. Query points are taken back into the child's frame with
+/// the inverse computed once, and distances are multiplied by the transform's scale. That is exact for
+/// rotations, translations and uniform scaling. Under non-uniform scaling or shear the smallest stretch
+/// is used and outside the child the distance to its box is taken when larger, so distances stay
+/// conservative but shading by distance (borders, blends) gets uneven
+class Transform final: public SDF {
+    std::shared_ptr<SDF> child_;
+    Affine inverse_;
+    double scale_;
+    bool similarity_;
+    Bounds bounds_;
+public:
+    Transform(std::shared_ptr<SDF> child, const Affine& transform):
+        child_(std::move(child)),
+        inverse_(transform.inverse()),
+        scale_(transform.minStretch()),
+        similarity_(transform.isSimilarity()),
+        bounds_(TransformedBounds(child_->bounds(), transform))
+    {
+        if (!(scale_ > 0) || !std::isfinite(inverse_.xx) || !std::isfinite(inverse_.yy)) {
+            std::cerr << "Transform must be invertible" << std::endl;
+            exit(1);
+        }
+    }
+
+    double distance(double x, double y) override {
+        double local_x, local_y;
+        inverse_.apply(x, y, local_x, local_y);
+        double distance = scale_ * child_->distance(local_x, local_y);
+        // only raised outside, inside the box the box distance is 0 and would flatten the interior
+        return similarity_ || distance <= 0 ? distance : std::max(distance, bounds_.distance(x, y));
+    }
+
+    RGBColor getColor(double x, double y) override {
+        double local_x, local_y;
+        inverse_.apply(x, y, local_x, local_y);
+        return child_->getColor(local_x, local_y);
+    }
+
+    LinearColor getLinearColor(double x, double y) override {
+        double local_x, local_y;
+        inverse_.apply(x, y, local_x, local_y);
+        return child_->getLinearColor(local_x, local_y);
+    }
+
+    double edgeDistance(double x, double y, double eps) override {
+        double local_x, local_y;
+        inverse_.apply(x, y, local_x, local_y);
+        return scale_ * child_->edgeDistance(local_x, local_y, eps / scale_);
+    }
+
+    Bounds bounds() const override {
+        return bounds_;
+    }
+};
+
+#endif //SDF_TRANSFORM_H
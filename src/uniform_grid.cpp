@@ -0,0 +1 @@
+#include "uniform_grid.h"
@@ -0,0 +1,142 @@
+#ifndef SDF_UNIFORM_GRID_H
+#define SDF_UNIFORM_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "bounds.h"
+
+/// Items binned by their boxes into a uniform grid over all of them, an item is listed in every cell
+/// its box touches. search() walks the cells in rings around a point, so a nearest-item query only
+/// looks at the items around the point. Sets of many nodes use it to stay sub-linear per pixel
+class UniformGrid {
+    std::vector<uint32_t> items_;      // the runs of all cells
+    std::vector<uint32_t> cell_start_; // run of cell c is items_[cell_start_[c], cell_start_[c + 1])
+    Bounds bounds_ = Bounds::Empty();
+    int columns_ = 1, rows_ = 1;
+    double cell_width_ = 1.0, cell_height_ = 1.0;
+
+    int column(double x) const {
+        return int(std::clamp((x - bounds_.x_min) / cell_width_, 0.0, double(columns_ - 1)));
+    }
+
+    int row(double y) const {
+        return int(std::clamp((y - bounds_.y_min) / cell_height_, 0.0, double(rows_ - 1)));
+    }
+public:
+    UniformGrid() = default;
+
+    /// Empty boxes (negative sizes) collapse to their middle, the item's distance still bounds from there
+    UniformGrid(std::vector<Bounds> boxes, size_t items_per_cell) {
+        for (Bounds& box : boxes) {
+            if (box.x_min > box.x_max) {
+                box.x_min = box.x_max = (box.x_min + box.x_max) / 2;
+            }
+            if (box.y_min > box.y_max) {
+                box.y_min = box.y_max = (box.y_min + box.y_max) / 2;
+            }
+            if (!std::isfinite(box.x_min) || !std::isfinite(box.x_max) ||
+                !std::isfinite(box.y_min) || !std::isfinite(box.y_max)) {
+                std::cerr << "Grid items need finite bounds" << std::endl;
+                exit(1);
+            }
+            bounds_ = bounds_.united(box);
+        }
+        size_t cells = std::max<size_t>(1, boxes.size() / items_per_cell);
+        double width = bounds_.x_max - bounds_.x_min, height = bounds_.y_max - bounds_.y_min;
+        double aspect = width > 0 && height > 0 ? width / height : (width > 0 ? double(cells) : 1.0 / double(cells));
+        columns_ = int(std::clamp(std::sqrt(double(cells) * aspect), 1.0, double(cells)));
+        rows_ = int(std::max<size_t>(1, cells / size_t(columns_)));
+        cell_width_ = width > 0 ? width / columns_ : 1.0;
+        cell_height_ = height > 0 ? height / rows_ : 1.0;
+
+        // boxes are registered slightly padded, so rounding can't hide them from a cell they touch
+        double slack = 1e-9 * std::max(cell_width_, cell_height_);
+        auto cover = [&](const Bounds& box, auto&& visit) {
+            for (int j = row(box.y_min - slack); j <= row(box.y_max + slack); ++j) {
+                for (int i = column(box.x_min - slack); i <= column(box.x_max + slack); ++i) {
+                    visit(size_t(j) * columns_ + i);
+                }
+            }
+        };
+        cell_start_.assign(size_t(columns_) * rows_ + 1, 0);
+        for (const Bounds& box : boxes) {
+            cover(box, [&](size_t cell) { ++cell_start_[cell + 1]; });
+        }
+        for (size_t c = 1; c < cell_start_.size(); ++c) {
+            cell_start_[c] += cell_start_[c - 1];
+        }
+        std::vector<uint32_t> fill(cell_start_.begin(), cell_start_.end() - 1);
+        items_.resize(cell_start_.back());
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            cover(boxes[i], [&](size_t cell) { items_[fill[cell]++] = uint32_t(i); });
+        }
+    }
+
+    /// Union of the items' boxes
+    const Bounds& bounds() const {
+        return bounds_;
+    }
+
+    /// All cell runs back to back, search() hands out ranges of this
+    const std::vector<uint32_t>& items() const {
+        return items_;
+    }
+
+    /// Calls visit(begin, end) for the runs of the cells in rings around (x, y). After each ring,
+    /// stop(bound) decides whether to go on, bound being how close any item not visited yet can be
+    template <typename Visit, typename Stop>
+    void search(double x, double y, Visit&& visit, Stop&& stop) const {
+        int center_i = column(x), center_j = row(y);
+        auto visit_cell = [&](int i, int j) {
+            size_t cell = size_t(j) * columns_ + i;
+            visit(size_t(cell_start_[cell]), size_t(cell_start_[cell + 1]));
+        };
+        for (int k = 0;; ++k) {
+            int i0 = std::max(center_i - k, 0), i1 = std::min(center_i + k, columns_ - 1);
+            int j0 = std::max(center_j - k, 0), j1 = std::min(center_j + k, rows_ - 1);
+            for (int i = i0; i <= i1; ++i) {
+                if (center_j - k >= 0) {
+                    visit_cell(i, center_j - k);
+                }
+                if (k > 0 && center_j + k < rows_) {
+                    visit_cell(i, center_j + k);
+                }
+            }
+            for (int j = std::max(center_j - k + 1, 0); j <= std::min(center_j + k - 1, rows_ - 1); ++j) {
+                if (center_i - k >= 0) {
+                    visit_cell(center_i - k, j);
+                }
+                if (center_i + k < columns_) {
+                    visit_cell(center_i + k, j);
+                }
+            }
+
+            // everything not visited lies in the grid outside the visited square
+            double x0 = bounds_.x_min + i0 * cell_width_, x1 = bounds_.x_min + (i1 + 1) * cell_width_;
+            double y0 = bounds_.y_min + j0 * cell_height_, y1 = bounds_.y_min + (j1 + 1) * cell_height_;
+            double bound = std::numeric_limits<double>::infinity();
+            if (i0 > 0) {
+                bound = std::min(bound, Bounds{bounds_.x_min, x0, bounds_.y_min, bounds_.y_max}.distance(x, y));
+            }
+            if (i1 < columns_ - 1) {
+                bound = std::min(bound, Bounds{x1, bounds_.x_max, bounds_.y_min, bounds_.y_max}.distance(x, y));
+            }
+            if (j0 > 0) {
+                bound = std::min(bound, Bounds{x0, x1, bounds_.y_min, y0}.distance(x, y));
+            }
+            if (j1 < rows_ - 1) {
+                bound = std::min(bound, Bounds{x0, x1, y1, bounds_.y_max}.distance(x, y));
+            }
+            if (bound == std::numeric_limits<double>::infinity() || stop(bound)) {
+                return;
+            }
+        }
+    }
+};
+
+#endif //SDF_UNIFORM_GRID_H
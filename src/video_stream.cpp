@@ -0,0 +1 @@
+#include "video_stream.h"
@@ -0,0 +1,150 @@
+#ifndef SDF_VIDEO_STREAM_H
+#define SDF_VIDEO_STREAM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+enum class StreamFormat {
+    Y4M420, // YUV4MPEG2, 4:2:0 chroma, what most encoders take without conversion
+    Y4M444, // YUV4MPEG2, full resolution chroma
+    RawRGB, // packed rgb24 frames without any header, e.g. for ffmpeg -f rawvideo -pix_fmt rgb24
+};
+
+// Full range BT.601 in 8.8 fixed point, the rows below vectorize well.
+// Chroma is clamped, pure red and blue round to 256 otherwise
+uint8_t RgbToY(int r, int g, int b) {
+    return uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+uint8_t RgbToU(int r, int g, int b) {
+    return uint8_t(std::min(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128, 255));
+}
+
+uint8_t RgbToV(int r, int g, int b) {
+    return uint8_t(std::min(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128, 255));
+}
+
+/// Converts one row of packed RGB to Y and full resolution U, V
+void RgbRowToYuv444(const uint8_t* rgb, size_t width, uint8_t* y, uint8_t* u, uint8_t* v) {
+    for (size_t j = 0; j < width; ++j) {
+        int r = rgb[3 * j], g = rgb[3 * j + 1], b = rgb[3 * j + 2];
+        y[j] = RgbToY(r, g, b);
+        u[j] = RgbToU(r, g, b);
+        v[j] = RgbToV(r, g, b);
+    }
+}
+
+/// Converts two rows of packed RGB to two rows of Y and one row of U, V averaged over 2x2 blocks
+void RgbRowPairToYuv420(const uint8_t* rgb0, const uint8_t* rgb1, size_t width,
+                        uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v) {
+    for (size_t j = 0; j < width; ++j) {
+        y0[j] = RgbToY(rgb0[3 * j], rgb0[3 * j + 1], rgb0[3 * j + 2]);
+        y1[j] = RgbToY(rgb1[3 * j], rgb1[3 * j + 1], rgb1[3 * j + 2]);
+    }
+    for (size_t j = 0; j < width / 2; ++j) {
+        size_t k = 6 * j;
+        int r = (rgb0[k] + rgb0[k + 3] + rgb1[k] + rgb1[k + 3] + 2) >> 2;
+        int g = (rgb0[k + 1] + rgb0[k + 4] + rgb1[k + 1] + rgb1[k + 4] + 2) >> 2;
+        int b = (rgb0[k + 2] + rgb0[k + 5] + rgb1[k + 2] + rgb1[k + 5] + 2) >> 2;
+        u[j] = RgbToU(r, g, b);
+        v[j] = RgbToV(r, g, b);
+    }
+}
+
+/// Writes a sequence of equally sized RGB frames to a stream, usually stdout piped into an encoder
+class VideoStreamWriter {
+    FILE* out_;
+    StreamFormat format_;
+    size_t height_, width_;
+    std::vector<uint8_t> y_plane_, u_plane_, v_plane_;
+    bool header_written_ = false;
+    int fps_;
+    bool failed_ = false;
+
+    void write(const void* data, size_t size) {
+        if (!failed_ && std::fwrite(data, 1, size, out_) != size) {
+            failed_ = true;
+        }
+    }
+
+    void writeHeader() {
+        if (format_ == StreamFormat::RawRGB) {
+            return;
+        }
+        std::string header = "YUV4MPEG2 W" + std::to_string(width_) + " H" + std::to_string(height_) +
+                             " F" + std::to_string(fps_) + ":1 Ip A1:1 " +
+                             (format_ == StreamFormat::Y4M420 ? "C420jpeg" : "C444") + " XCOLORRANGE=FULL\n";
+        write(header.data(), header.size());
+    }
+public:
+    VideoStreamWriter(FILE* out, StreamFormat format, size_t height, size_t width, int fps=30):
+        out_(out),
+        format_(format),
+        height_(height),
+        width_(width),
+        fps_(fps) {
+        if (format_ == StreamFormat::Y4M420 && (height_ % 2 || width_ % 2)) {
+            std::cerr << "4:2:0 streams need even frame dimensions" << std::endl;
+            exit(1);
+        }
+        if (format_ == StreamFormat::Y4M420) {
+            y_plane_.resize(height_ * width_);
+            u_plane_.resize((height_ / 2) * (width_ / 2));
+            v_plane_.resize((height_ / 2) * (width_ / 2));
+        } else if (format_ == StreamFormat::Y4M444) {
+            y_plane_.resize(height_ * width_);
+            u_plane_.resize(height_ * width_);
+            v_plane_.resize(height_ * width_);
+        }
+    }
+
+    /// false once a write failed, e.g. because the reading end of the pipe went away
+    bool good() const { return !failed_; }
+
+    void WriteFrame(const AlignedImage<uint8_t, 3>& frame) {
+        if (!header_written_) {
+            writeHeader();
+            header_written_ = true;
+        }
+        switch (format_) {
+            case StreamFormat::RawRGB:
+                for (size_t i = 0; i < height_; ++i) {
+                    write(frame.row(i), width_ * 3);
+                }
+                break;
+            case StreamFormat::Y4M444:
+                for (size_t i = 0; i < height_; ++i) {
+                    RgbRowToYuv444(frame.row(i), width_, &y_plane_[i * width_],
+                                   &u_plane_[i * width_], &v_plane_[i * width_]);
+                }
+                break;
+            case StreamFormat::Y4M420: {
+                size_t chroma_width = width_ / 2;
+                for (size_t i = 0; i + 1 < height_; i += 2) {
+                    RgbRowPairToYuv420(frame.row(i), frame.row(i + 1), width_,
+                                       &y_plane_[i * width_], &y_plane_[(i + 1) * width_],
+                                       &u_plane_[i / 2 * chroma_width], &v_plane_[i / 2 * chroma_width]);
+                }
+                break;
+            }
+        }
+        if (format_ != StreamFormat::RawRGB) {
+            write("FRAME\n", 6);
+            write(y_plane_.data(), y_plane_.size());
+            write(u_plane_.data(), u_plane_.size());
+            write(v_plane_.data(), v_plane_.size());
+        }
+        if (std::fflush(out_) != 0) {
+            failed_ = true;
+        }
+    }
+};
+
+#endif //SDF_VIDEO_STREAM_H